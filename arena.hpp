@@ -0,0 +1,235 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace eco {
+
+/**
+ * Bump allocator over a single block reserved when the World is constructed
+ *
+ * Both grids, the move queues and any scratch buffers are carved out of it,
+ * so nothing touches the system allocator once the simulation is running.
+ * Every allocation is aligned to a cache line (which also covers any SIMD
+ * width we compile for). Blocks of at least one huge page are backed by
+ * explicit huge pages when the system has them reserved, otherwise they are
+ * aligned to 2MB and advised for transparent huge pages.
+ *
+ * The whole block is faulted in up front so the first generation doesn't pay
+ * for page faults either.
+ *
+ * If the block can't be reserved the arena is left empty and ok() is false.
+ * It then hands out null pointers, so whoever owns it must check ok() before
+ * touching anything it allocated.
+ *
+ * An arena can instead be backed by a file, for worlds that don't fit in
+ * memory. Then nothing is faulted in: pages come and go through the page
+ * cache, and prefetch, writeback and discard let the caller tell the kernel
+ * which parts are about to be used and which are done with.
+ */
+
+constexpr size_t CACHE_LINE = 64;
+constexpr size_t HUGE_PAGE  = 2 * 1024 * 1024;
+
+struct Arena {
+    char* block;      // What mmap returned, needed for munmap
+    char* base;       // First usable byte, aligned
+    size_t mapped;    // Size of the mapping
+    size_t capacity;  // Usable bytes from base
+    size_t used;      // Bytes handed out so far
+    bool huge;        // Backed by explicit huge pages
+    int fd;           // Backing file, -1 for anonymous memory
+
+    Arena() = delete;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    explicit Arena(size_t bytes, const char* path = nullptr);
+    ~Arena();
+
+    template <class T>
+    T* allocate(size_t n);
+
+    void prefetch(const void* p, size_t n) const;
+    void writeback(const void* p, size_t n) const;
+    void discard(void* p, size_t n) const;
+    bool fitsInMemory() const;
+    bool ok() const { return base != nullptr; }
+
+    void mapAnonymous(size_t bytes);
+    void mapFile(size_t bytes, const char* path);
+
+    static constexpr size_t align(size_t bytes, size_t to = CACHE_LINE) {
+        return (bytes + to - 1) & ~(to - 1);
+    }
+};
+
+/**
+ * Anonymous memory, or a block of the file at path if there is one
+ */
+inline Arena::Arena(size_t bytes, const char* path)
+    : block(nullptr), base(nullptr), mapped(0), capacity(0), used(0), huge(false), fd(-1) {
+    if (path != nullptr)
+        mapFile(bytes, path);
+    else
+        mapAnonymous(bytes);
+}
+
+inline void Arena::mapAnonymous(size_t bytes) {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    void* p = MAP_FAILED;
+
+    capacity = align(bytes > 0 ? bytes : CACHE_LINE, page);
+
+#ifdef MAP_HUGETLB
+    if (capacity >= HUGE_PAGE) {
+        mapped = align(capacity, HUGE_PAGE);
+        p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        huge = p != MAP_FAILED;
+    }
+#endif
+
+    if (p == MAP_FAILED) {
+        // Over-allocate so the usable region can start on a 2MB boundary
+        mapped = capacity >= HUGE_PAGE ? capacity + HUGE_PAGE : capacity;
+        p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    if (p == MAP_FAILED) {
+        mapped = capacity = 0;
+        return;
+    }
+
+    block = static_cast<char*>(p);
+    base  = block;
+
+    if (!huge && capacity >= HUGE_PAGE) {
+        base = reinterpret_cast<char*>(
+            align(reinterpret_cast<uintptr_t>(block), HUGE_PAGE));
+#ifdef MADV_HUGEPAGE
+        madvise(base, capacity, MADV_HUGEPAGE);
+#endif
+    }
+
+    // Fault everything in now rather than during the first update
+    for (size_t off = 0; off < capacity; off += page)
+        base[off] = 0;
+}
+
+/**
+ * Maps the file at path, which is created or truncated. The file starts out
+ * sparse so untouched allocations take no disk space
+ */
+inline void Arena::mapFile(size_t bytes, const char* path) {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    capacity = mapped = align(bytes > 0 ? bytes : CACHE_LINE, page);
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void* p = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(mapped)) == 0)
+        p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        if (fd >= 0)
+            close(fd);
+        fd     = -1;
+        mapped = capacity = 0;
+        return;
+    }
+
+    block = base = static_cast<char*>(p);
+}
+
+inline Arena::~Arena() {
+    if (block != nullptr)
+        munmap(block, mapped);
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Returns zeroed, cache line aligned storage for n objects of type T
+ *
+ * Memory is never handed back individually, it all goes away with the arena.
+ */
+template <class T>
+inline T* Arena::allocate(size_t n) {
+    if (!ok())
+        return nullptr;
+    const size_t bytes = align(n * sizeof(T));
+    if (used + bytes > capacity) {
+        fprintf(stderr, "Arena: out of space (%zu + %zu > %zu)\n", used, bytes,
+                capacity);
+        abort();
+    }
+    T* p = reinterpret_cast<T*>(base + used);
+    used += bytes;
+    return p;
+}
+
+/**
+ * Starts reading [p, p + n) in the background
+ */
+inline void Arena::prefetch(const void* p, size_t n) const {
+    const size_t page  = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t first = (static_cast<const char*>(p) - base) & ~(page - 1);
+    const size_t last  = align(static_cast<const char*>(p) - base + n, page);
+    madvise(base + first, last - first, MADV_WILLNEED);
+}
+
+/**
+ * Starts writing [p, p + n) back to the file without waiting for it, so clean
+ * pages can be reclaimed once the range is done with. Nothing to do for
+ * anonymous memory
+ */
+inline void Arena::writeback(const void* p, size_t n) const {
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (fd < 0)
+        return;
+    const size_t page  = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t first = (static_cast<const char*>(p) - base) & ~(page - 1);
+    const size_t last  = align(static_cast<const char*>(p) - base + n, page);
+    sync_file_range(fd, static_cast<off_t>(first), static_cast<off_t>(last - first),
+                    SYNC_FILE_RANGE_WRITE);
+#else
+    (void)p, (void)n;
+#endif
+}
+
+/**
+ * Whether the block can stay in the page cache alongside everything else,
+ * taken as half the physical memory
+ */
+inline bool Arena::fitsInMemory() const {
+    const size_t page  = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t pages = static_cast<size_t>(sysconf(_SC_PHYS_PAGES));
+    return capacity <= pages / 2 * page;
+}
+
+/**
+ * Drops the whole pages inside [p, p + n), which read back as zero. Their
+ * contents are never written to the file
+ */
+inline void Arena::discard(void* p, size_t n) const {
+    const size_t page  = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t first = align(static_cast<size_t>(static_cast<char*>(p) - base), page);
+    const size_t last  = (static_cast<char*>(p) - base + n) & ~(page - 1);
+    if (last <= first)
+        return;
+#ifdef MADV_REMOVE
+    if (fd >= 0) {
+        madvise(base + first, last - first, MADV_REMOVE);
+        return;
+    }
+#endif
+    madvise(base + first, last - first, MADV_DONTNEED);
+}
+
+} // namespace eco
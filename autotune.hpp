@@ -0,0 +1,176 @@
+#pragma once
+
+/**
+ * autotune.hpp
+ *
+ * Picks the fastest Schedule for a world by timing a few generations of each
+ * candidate on a scratch sample of it: thread counts in powers of two up to
+ * the world's max_threads, even or balanced blocks, and a few band heights.
+ *
+ * The sample is at most TRIAL_CELLS cells, so tuning a large world doesn't
+ * need a second one as large. It keeps the leftmost columns and takes its
+ * rows tile band by tile band, spread evenly down the world, so balanced
+ * blocks see roughly where the entities are. Worlds that fit are copied
+ * whole. Streaming worlds aren't tuned at all and keep their schedule.
+ *
+ * The choice can be cached in a text file, one line per key, later lines
+ * winning:
+ *
+ *     engine height width max_threads threads balanced band
+ *
+ * A choice only holds for the engine, grid shape and thread budget it was
+ * timed with, so lines that differ in any of those, or don't parse, are
+ * skipped and tuning runs again.
+ *
+ * Must be included after the engine header. The sequential engine has
+ * nothing to tune.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "density.hpp"
+#include "schedule.hpp"
+
+namespace eco {
+
+constexpr int TRIAL_CELLS = 1 << 20;
+
+// Names the engine in cache lines
+inline const char* tunedEngine() {
+#ifdef PULL
+    return "pull";
+#else
+    return "queue";
+#endif
+}
+
+inline bool loadSchedule(const char* path, int h, int w, int maxThreads, Schedule& s) {
+    FILE* f = path ? fopen(path, "r") : nullptr;
+    if (f == nullptr)
+        return false;
+
+    bool found = false;
+    char line[256], engine[16];
+    int fh, fw, fmax, threads, balanced, band;
+    while (fgets(line, sizeof line, f) != nullptr) {
+        if (sscanf(line, "%15s %d %d %d %d %d %d", engine, &fh, &fw, &fmax, &threads,
+                   &balanced, &band) != 7 ||
+            strcmp(engine, tunedEngine()) != 0 || fh != h || fw != w || fmax != maxThreads ||
+            threads < 1 || threads > maxThreads || band < 1)
+            continue;
+        s = {threads, balanced != 0, band};
+        found = true;
+    }
+    fclose(f);
+    return found;
+}
+
+inline void saveSchedule(const char* path, int h, int w, int maxThreads, const Schedule& s) {
+    FILE* f = path ? fopen(path, "a") : nullptr;
+    if (f == nullptr)
+        return;
+    fprintf(f, "%s %d %d %d %d %d %d\n", tunedEngine(), h, w, maxThreads, s.threads,
+            s.balanced ? 1 : 0, s.band);
+    fclose(f);
+}
+
+inline std::vector<Schedule> candidateSchedules(int maxThreads, int rows) {
+    std::vector<int> threads;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threads.push_back(t);
+    threads.push_back(maxThreads);
+
+    std::vector<Schedule> out;
+    for (int t : threads) {
+        for (int band = DensityIndex::TILE; band == DensityIndex::TILE || band * t <= rows;
+             band *= 4) {
+            out.push_back({t, false, band});
+            if (t > 1)
+                out.push_back({t, true, band});
+        }
+    }
+    return out;
+}
+
+#ifdef _OPENMP
+/**
+ * Fills trial with the sample of world it has room for, as described above
+ */
+inline void loadSample(World& trial, const World& world) {
+    constexpr int TILE = DensityIndex::TILE;
+    const int h = world.height - 1;
+    const int th = trial.height - 1, tw = trial.width - 1;
+    const int bands = (h + TILE - 1) / TILE, trialBands = (th + TILE - 1) / TILE;
+
+    for (int i = 0; i < th; ++i) {
+        const int band = static_cast<int>(static_cast<int64_t>(i / TILE) * bands / trialBands);
+        const int row  = std::min(band * TILE + i % TILE, h - 1);
+        for (int j = 0; j < tw; ++j)
+            trial.add(world.map(row + 1, j + 1), i, j);
+    }
+    trial.current_gen = world.current_gen;
+}
+#endif
+
+/**
+ * Times gens generations of every candidate schedule, applies the fastest
+ * to world and returns it. A cached choice for the same engine, shape and
+ * max_threads is used without timing anything.
+ */
+inline Schedule autotune(World& world, int gens, const char* cachePath) {
+#ifdef _OPENMP
+    using namespace std::chrono;
+
+    constexpr int TILE = DensityIndex::TILE;
+    const int h = world.height - 1, w = world.width - 1;
+    Schedule best = world.schedule;
+
+#ifdef PULL
+    if (world.streamBand > 0)
+        return best;
+#endif
+
+    if (loadSchedule(cachePath, h, w, world.max_threads, best)) {
+        world.setSchedule(best);
+        return world.schedule;
+    }
+
+    const int tw = std::min(w, TRIAL_CELLS / TILE);
+    const int th = std::min(h, std::max(TILE, TRIAL_CELLS / tw / TILE * TILE));
+    World trial(world.species, tw, th, world.entity_count, world.max_threads);
+    if (!trial.arena.ok())
+        return best;
+    trial.init();
+
+    auto bestTime = nanoseconds::max();
+    for (const Schedule& s : candidateSchedules(world.max_threads, th)) {
+        loadSample(trial, world);
+        trial.setSchedule(s);
+        // Fast-forwarding is off: its set-up pass over the grid has nothing to
+        // do with the schedule, and a skip would leave nothing to time
+        trial.run(1, false);  // Warm up the threads and caches
+
+        const auto t1 = high_resolution_clock::now();
+        trial.run(gens, false);
+        const auto t2 = high_resolution_clock::now();
+
+        if (t2 - t1 < bestTime) {
+            bestTime = t2 - t1;
+            best     = trial.schedule;
+        }
+    }
+
+    world.setSchedule(best);
+    saveSchedule(cachePath, h, w, world.max_threads, world.schedule);
+    return world.schedule;
+#else
+    (void)world, (void)gens, (void)cachePath;
+    return defaultSchedule(1);
+#endif
+}
+
+} // namespace eco
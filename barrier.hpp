@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() asm volatile("yield")
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+#include "arena.hpp"
+
+namespace eco {
+
+/**
+ * Sense-reversing spin barrier
+ *
+ * The last thread to arrive resets the counter and flips the shared sense,
+ * everyone else spins on it. Each thread keeps its own copy of the sense,
+ * initialised from sense() when it enters the parallel region.
+ *
+ * Waiting backs off exponentially with pause instructions and starts yielding
+ * the core after a while. When there are more threads than cores it yields
+ * straight away so it doesn't starve the thread everyone is waiting for.
+ */
+
+struct SpinBarrier {
+    alignas(CACHE_LINE) std::atomic<int> remaining;
+    alignas(CACHE_LINE) std::atomic<bool> flag;
+    int count;
+    int rounds;  // Spin rounds before yielding, none when oversubscribed
+
+    SpinBarrier() = delete;
+    explicit SpinBarrier(int n) : remaining(n), flag(false), count(n), rounds(0) {
+        reset(n);
+    }
+
+    // Changes the number of threads, only while nobody is waiting
+    void reset(int n) {
+        count = n;
+        remaining.store(n, std::memory_order_relaxed);
+        rounds = std::thread::hardware_concurrency() >= static_cast<unsigned>(n) ? 16 : 0;
+    }
+
+    bool sense() const { return flag.load(std::memory_order_acquire); }
+    inline void wait(bool& local);
+};
+
+inline void SpinBarrier::wait(bool& local) {
+    local = !local;
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        remaining.store(count, std::memory_order_relaxed);
+        flag.store(local, std::memory_order_release);
+        return;
+    }
+
+    constexpr int MAX_SPINS = 64;  // Pauses per round before backing off
+    int spins = 1, round = 0;
+    while (flag.load(std::memory_order_acquire) != local) {
+        if (round < rounds) {
+            for (int i = 0; i < spins; ++i)
+                CPU_RELAX();
+            if (spins < MAX_SPINS)
+                spins <<= 1;
+            else
+                ++round;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+} // namespace eco
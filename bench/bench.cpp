@@ -0,0 +1,314 @@
+/**
+ * bench.cpp
+ *
+ * Microbenchmarks for the simulation kernels on synthetic grids.
+ *
+ * Grids are filled at a few fixed densities from a fixed seed (half rabbits,
+ * a third foxes, the rest rocks), so numbers are repeatable between runs and
+ * between builds. Every kernel is timed over several repetitions and the
+ * median is reported as ticks and nanoseconds per op, next to the bytes of
+ * simulation data each op touches. Ticks are read with rdtsc, which counts at
+ * a fixed reference rate rather than the core's clock, so they are not core
+ * cycles; elsewhere they are nanoseconds.
+ *
+ * Usage: bench [size] [kernel-filter]
+ */
+
+#define DEBUG 0
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t ticks() { return __rdtsc(); }
+#else
+inline uint64_t ticks() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#include "../arena.hpp"
+#include "../barrier.hpp"
+#include "../concurrentvector.hpp"
+#include "../matrix.hpp"
+#include "../world_sequential.hpp"
+
+using namespace eco;
+using namespace std::chrono;
+
+constexpr int REPS = 7;
+constexpr double DENSITIES[] = {0.1, 0.5, 0.9};
+
+volatile int64_t sink;
+
+struct Result {
+    double ticks;
+    double ns;
+};
+
+/**
+ * Runs body REPS times and returns the median cost of one of its ops
+ */
+template <class F>
+Result measure(int64_t ops, F body) {
+    std::vector<Result> runs;
+    for (int r = 0; r < REPS; ++r) {
+        const auto t1 = high_resolution_clock::now();
+        const uint64_t c1 = ticks();
+        body();
+        const uint64_t c2 = ticks();
+        const auto t2 = high_resolution_clock::now();
+        runs.push_back({static_cast<double>(c2 - c1) / ops,
+                        static_cast<double>(duration_cast<nanoseconds>(t2 - t1).count()) / ops});
+    }
+    std::sort(runs.begin(), runs.end(),
+              [](const Result& a, const Result& b) { return a.ticks < b.ticks; });
+    return runs[REPS / 2];
+}
+
+void report(const std::string& kernel, const std::string& config, int64_t ops,
+            double bytes, const Result& r) {
+    printf("%-28s %-14s %12lld %10.2f %10.2f %10.1f\n", kernel.c_str(), config.c_str(),
+           static_cast<long long>(ops), r.ticks, r.ns, bytes);
+}
+
+// Swallows everything written to it, counting the bytes
+struct CountingBuf : std::streambuf {
+    int64_t bytes = 0;
+    int overflow(int c) override { ++bytes; return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        bytes += n;
+        return n;
+    }
+};
+
+SpeciesTable benchSpecies() {
+    SpeciesTable species{};
+    species[RABBIT] = {2, 0};
+    species[FOX]    = {4, 3};
+    return species;
+}
+
+struct Grid {
+    World world;
+    std::vector<std::pair<int, int>> rabbits;
+    std::vector<std::pair<int, int>> foxes;
+
+    Grid(int n, double density) : world(benchSpecies(), n, n, 0) {
+        world.init();
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> u(0, 1);
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                if (u(rng) >= density)
+                    continue;
+                const double k = u(rng);
+                const Entity_t t = k < 0.5 ? RABBIT : k < 0.83 ? FOX : ROCK;
+                world.add(t, i, j);
+                if (t == RABBIT) rabbits.push_back({i + 1, j + 1});
+                if (t == FOX)    foxes.push_back({i + 1, j + 1});
+            }
+        }
+        world.nextMap = world.map;
+    }
+};
+
+bool selected(const char* filter, const char* kernel) {
+    return filter == nullptr || std::strstr(kernel, filter) != nullptr;
+}
+
+void benchGrid(int n, double density, const char* filter) {
+    Grid g(n, density);
+    World& w = g.world;
+    char config[32];
+    snprintf(config, sizeof config, "%dx%d@%.1f", n, n, density);
+    const int64_t cells = static_cast<int64_t>(n) * n;
+
+    if (selected(filter, "getMove<EMPTY>") && !g.rabbits.empty()) {
+        const int64_t ops = g.rabbits.size();
+        auto r = measure(ops, [&] {
+            int64_t k = 0;
+            for (auto p : g.rabbits) {
+                int x = p.first, y = p.second;
+                k += w.getMove<EMPTY>(x, y) + x + y;
+            }
+            sink = k;
+        });
+        report("getMove<EMPTY>", config, ops, 4 * sizeof(Entity), r);
+    }
+
+    if (selected(filter, "getMove<RABBIT>") && !g.foxes.empty()) {
+        const int64_t ops = g.foxes.size();
+        auto r = measure(ops, [&] {
+            int64_t k = 0;
+            for (auto p : g.foxes) {
+                int x = p.first, y = p.second;
+                k += w.getMove<RABBIT>(x, y) + x + y;
+            }
+            sink = k;
+        });
+        report("getMove<RABBIT>", config, ops, 4 * sizeof(Entity), r);
+    }
+
+    // Each cell, as the incoming occupant, against its right neighbour
+    if (selected(filter, "winsCell<Rabbits>")) {
+        auto r = measure(cells, [&] {
+            int64_t k = 0;
+            for (int i = 1; i <= n; ++i)
+                for (int j = 1; j <= n; ++j)
+                    k += winsCell<Rabbits>(w.map(i, j), w.map(i, j + 1));
+            sink = k;
+        });
+        report("winsCell<Rabbits>", config, cells, 2 * sizeof(Entity), r);
+    }
+
+    if (selected(filter, "winsCell<Foxes>")) {
+        auto r = measure(cells, [&] {
+            int64_t k = 0;
+            for (int i = 1; i <= n; ++i)
+                for (int j = 1; j <= n; ++j)
+                    k += winsCell<Foxes>(w.map(i, j), w.map(i, j + 1));
+            sink = k;
+        });
+        report("winsCell<Foxes>", config, cells, 2 * sizeof(Entity), r);
+    }
+
+    if (selected(filter, "Matrix::operator=")) {
+        const int64_t ops = w.map.size;
+        auto r = measure(ops, [&] {
+            w.nextMap = w.map;
+            sink = w.nextMap.arr[ops / 2].type;
+        });
+        report("Matrix::operator=", config, ops, 2 * sizeof(Entity), r);
+    }
+
+    if (selected(filter, "countEntities")) {
+        auto r = measure(cells, [&] { sink = w.countEntities(); });
+        report("countEntities", config, cells, sizeof(Entity), r);
+    }
+
+    if (selected(filter, "printText")) {
+        CountingBuf buf;
+        std::streambuf* old = std::cout.rdbuf(&buf);
+        auto r = measure(cells, [&] { w.printText(); });
+        std::cout.rdbuf(old);
+        report("printText", config, cells,
+               sizeof(Entity) + static_cast<double>(buf.bytes) / REPS / cells, r);
+    }
+}
+
+/**
+ * threads threads pushing into one vector at once. The threads are started
+ * once and lined up on a barrier before each repetition, so only the pushes
+ * and the barrier hand-offs are timed, not thread creation
+ */
+void benchPushBack(int threads, const char* filter) {
+    if (!selected(filter, "ConcurrentVector::push_back"))
+        return;
+
+    struct Move {
+        int x;
+        int y;
+        Entity next;
+    };
+
+    constexpr int PER_THREAD = 1 << 16;
+    const int64_t ops = static_cast<int64_t>(threads) * PER_THREAD;
+
+    Arena arena(ConcurrentVector<Move>::bytes(ops));
+    ConcurrentVector<Move> vec;
+    vec.reserve(arena, ops);
+
+    // The pushing threads and this one, which times each repetition
+    SpinBarrier barrier(threads + 1);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back([&vec, &barrier, t] {
+            bool sense = barrier.sense();
+            for (int r = 0; r < REPS; ++r) {
+                barrier.wait(sense);
+                for (int i = 0; i < PER_THREAD; ++i)
+                    vec.push_back({t, i, {RABBIT, 0, 0}});
+                barrier.wait(sense);
+            }
+        });
+
+    bool sense = barrier.sense();
+    auto r = measure(ops, [&] {
+        vec.clear();
+        barrier.wait(sense);
+        barrier.wait(sense);
+        sink = vec.size();
+    });
+    for (auto& th : pool)
+        th.join();
+
+    char config[32];
+    snprintf(config, sizeof config, "%d threads", threads);
+    report("ConcurrentVector::push_back", config, ops, sizeof(Move), r);
+}
+
+/**
+ * One crossing of a SpinBarrier by threads threads, the hand-off the parallel
+ * engines make several times a generation. The threads are started and lined
+ * up once, then cross it ROUNDS times per repetition with no work in between
+ */
+void benchBarrier(int threads, const char* filter) {
+    if (!selected(filter, "SpinBarrier::wait"))
+        return;
+
+    constexpr int ROUNDS = 1 << 12;
+
+    // The waiting threads and this one, which times each repetition
+    SpinBarrier barrier(threads);
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t)
+        pool.emplace_back([&barrier] {
+            bool sense = barrier.sense();
+            barrier.wait(sense);
+            for (int i = 0; i < REPS * ROUNDS; ++i)
+                barrier.wait(sense);
+        });
+
+    bool sense = barrier.sense();
+    barrier.wait(sense);
+    auto r = measure(ROUNDS, [&] {
+        for (int i = 0; i < ROUNDS; ++i)
+            barrier.wait(sense);
+    });
+    for (auto& th : pool)
+        th.join();
+
+    char config[32];
+    snprintf(config, sizeof config, "%d threads", threads);
+    report("SpinBarrier::wait", config, ROUNDS, 0, r);
+}
+
+int main(int argc, char** argv) {
+    const int n = argc > 1 ? std::max(1, atoi(argv[1])) : 256;
+    const char* filter = argc > 2 ? argv[2] : nullptr;
+
+    printf("%-28s %-14s %12s %10s %10s %10s\n", "kernel", "config", "ops",
+           "ticks/op", "ns/op", "bytes/op");
+
+    for (double d : DENSITIES)
+        benchGrid(n, d, filter);
+
+    for (int t = 1; t <= 8; t *= 2)
+        benchPushBack(t, filter);
+
+    for (int t = 2; t <= 8; t *= 2)
+        benchBarrier(t, filter);
+
+    return 0;
+}
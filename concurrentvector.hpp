@@ -1,44 +1,54 @@
 #pragma once
 
-#include <deque>
-#include <condition_variable>
-#include <mutex>
+#include <atomic>
+
+#include "arena.hpp"
+
+namespace eco {
 
 /**
- * Wrapper around std::vector for thread safe push_back
+ * Fixed capacity vector with thread safe push_back
+ *
+ * Storage is reserved from an Arena up front, so pushing never allocates.
+ * Callers are responsible for never exceeding the reserved capacity. Each
+ * vector takes a cache line of its own, so threads pushing to neighbouring
+ * vectors of an array don't contend for their counters.
  */
 
 template <typename T>
-struct ConcurrentVector {
-    using Container = std::vector<T>;
-    using Lock      = std::unique_lock<std::mutex>;
+struct alignas(CACHE_LINE) ConcurrentVector {
+    T* vec;
+    int capacity;
+    std::atomic<int> count;
 
-    Container vec;
-    
-    std::mutex mut;
-    std::condition_variable cond;
-
-    ConcurrentVector() = default;
+    ConcurrentVector() : vec(nullptr), capacity(0), count(0) {}
     ~ConcurrentVector() = default;
 
+    void reserve(Arena& arena, int n) {
+        vec      = arena.allocate<T>(n);
+        capacity = n;
+    }
+
+    static size_t bytes(int n) {
+        return Arena::align(n * sizeof(T));
+    }
+
     void push_back(T&& item) {
-        Lock lk{mut};
-        vec.emplace_back(std::move(item));
-        lk.unlock();
-        cond.notify_one();
+        const int i = count.fetch_add(1, std::memory_order_relaxed);
+        vec[i] = std::move(item);
     }
 
     const T& operator[](size_t i) const {
         return vec[i];
     }
 
-    int size() {
-        Lock mlock{mut};
-        return vec.size();
+    int size() const {
+        return count.load(std::memory_order_relaxed);
     }
 
     void clear() {
-        Lock mlock{mut};
-        vec.clear();
+        count.store(0, std::memory_order_relaxed);
     }
 };
+
+} // namespace eco
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+
+#include "arena.hpp"
+#include "debug.hpp"
+#include "entity.hpp"
+#include "matrix.hpp"
+#include "species.hpp"
+
+/**
+ * cycle.hpp
+ *
+ * Zobrist-style hashing of the grid and detection of repeated world states.
+ *
+ * Each (cell, entity) pair maps to a pseudo-random 64 bit key and the world
+ * hash is the xor of the keys of every occupied cell, so the engines can keep
+ * it up to date with one xor per write. Ages and hunger are unbounded, which
+ * rules out a precomputed table; keys are derived with the splitmix64
+ * finalizer instead.
+ *
+ * selectDirection only looks at current_gen modulo 1, 2, 3 and 4, so two
+ * identical grids whose generations agree modulo 12 evolve identically
+ * forever. Repeats are found with Brent's algorithm: a copy of the grid is
+ * checkpointed at every power of two generation and each new state is
+ * compared against it, hash first and cell by cell on a hash hit, so a
+ * detected cycle is exact.
+ *
+ * A grid packed with rabbits never repeats, since the rabbits that can't move
+ * keep getting older. Once no animal can move or eat and none of them can
+ * starve, the cell types can't change any more though, and a generation only
+ * ages every animal by one. frozen() spots that, at the same checkpoints, and
+ * ageAnimals() skips any number of generations of it. Both go through
+ * Ecosystem, so they know every species.
+ */
+
+namespace eco {
+
+constexpr int GEN_PERIOD = 12;  // lcm(1, 2, 3, 4)
+
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t cellKey(size_t index, const Entity& e) {
+    if (e.type == EMPTY)
+        return 0;
+    const uint64_t fields = static_cast<uint64_t>(e.type) << 32 |
+                            static_cast<uint64_t>(static_cast<uint16_t>(e.age)) << 16 |
+                            static_cast<uint64_t>(static_cast<uint16_t>(e.hunger));
+    return mix64(mix64(static_cast<uint64_t>(index)) ^ fields);
+}
+
+inline uint64_t hashGrid(const Matrix<Entity>& m) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < m.size; ++i)
+        h ^= cellKey(i, m.arr[i]);
+    return h;
+}
+
+inline bool sameEntity(const Entity& a, const Entity& b) {
+    return a.type == b.type && a.age == b.age && a.hunger == b.hunger;
+}
+
+inline bool sameGrid(const Matrix<Entity>& a, const Matrix<Entity>& b) {
+    return std::equal(a.arr, a.arr + a.size, b.arr, sameEntity);
+}
+
+// Whether any animal of a species that starves is alive, which keeps getting hungrier
+inline bool anyStarving(const int64_t* population) {
+    bool alive = false;
+    Ecosystem::forEach([&](auto species) {
+        using S = typename decltype(species)::type;
+        alive = alive || (S::starves && population[S::type] > 0);
+    });
+    return alive;
+}
+
+/**
+ * Whether no animal of the grid can move or eat. With none that can starve
+ * either, no cell can change type again, as described above
+ */
+inline bool frozen(const Matrix<Entity>& map) {
+    bool still = true;
+    Ecosystem::forEach([&](auto species) {
+        using S = typename decltype(species)::type;
+        auto next = [&](int i, int j, Entity_t t) {
+            return map(i - 1, j).type == t || map(i, j + 1).type == t ||
+                   map(i + 1, j).type == t || map(i, j - 1).type == t;
+        };
+        for (int i = 1; still && i < map.height - 1; ++i)
+            for (int j = 1; still && j < map.width - 1; ++j)
+                if (map(i, j).type == S::type &&
+                    (next(i, j, EMPTY) || (hunts<S>() && next(i, j, S::prey))))
+                    still = false;
+    });
+    return still;
+}
+
+// Ages every animal by gens generations, wrapping the way ++age does
+inline void ageAnimals(Matrix<Entity>& map, int gens) {
+    const uint16_t by = static_cast<uint16_t>(gens);
+    for (size_t i = 0; i < map.size; ++i)
+        if (Ecosystem::contains(map.arr[i].type))
+            map.arr[i].age = static_cast<short>(static_cast<uint16_t>(map.arr[i].age + by));
+}
+
+struct CycleDetector {
+    Matrix<Entity> saved;
+    uint64_t savedHash;
+    int savedGen;
+    int nextCheckpoint;  // Generation offset at which the checkpoint moves
+
+    CycleDetector() = delete;
+    CycleDetector(int h, int w, Arena& arena)
+        : saved(h, w, arena), savedHash(0), savedGen(0), nextCheckpoint(1) {}
+
+    static size_t bytes(int h, int w) { return Matrix<Entity>::bytes(h, w); }
+
+    void reset(const Matrix<Entity>& map, uint64_t hash, int gen);
+    int check(const Matrix<Entity>& map, uint64_t hash, int gen);
+
+    // Whether check() will move the checkpoint at gen
+    bool due(int gen) const { return gen - savedGen == nextCheckpoint; }
+};
+
+inline void CycleDetector::reset(const Matrix<Entity>& map, uint64_t hash, int gen) {
+    saved          = map;
+    savedHash      = hash;
+    savedGen       = gen;
+    nextCheckpoint = 1;
+}
+
+/**
+ * Call once per generation. Returns the length of the cycle if this state was
+ * seen before at the same generation phase, 0 otherwise.
+ */
+inline int CycleDetector::check(const Matrix<Entity>& map, uint64_t hash, int gen) {
+    const int dist = gen - savedGen;
+    if (hash == savedHash && dist % GEN_PERIOD == 0 && sameGrid(map, saved))
+        return dist;
+
+    if (dist == nextCheckpoint) {
+        saved          = map;
+        savedHash      = hash;
+        savedGen       = gen;
+        nextCheckpoint = std::min(2 * nextCheckpoint, 1 << 30);
+    }
+    return 0;
+}
+
+/**
+ * Called after every generation of w while detect is set: jumps towards
+ * target once the state has frozen or repeated. Clears detect after a jump,
+ * since fewer generations than a cycle are left
+ */
+template <class W>
+inline void fastForward(W& w, int target, bool& detect) {
+    if (!anyStarving(w.population) && w.cycles.due(w.current_gen) && frozen(w.map)) {
+        dbg::LOGLN("Frozen at generation %d", w.current_gen);
+        ageAnimals(w.map, target - w.current_gen);
+        ageAnimals(w.nextMap, target - w.current_gen);
+        w.current_gen = target;
+        detect = false;
+        return;
+    }
+    const int len = w.cycles.check(w.map, w.hash, w.current_gen);
+    if (len > 0) {
+        dbg::LOGLN("Cycle of length %d at generation %d", len, w.current_gen);
+        w.current_gen += (target - w.current_gen) / len * len;
+        detect = false;
+    }
+}
+
+} // namespace eco
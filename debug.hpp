@@ -6,9 +6,10 @@
 
 #ifdef DEBUG
 
+namespace eco {
 namespace dbg {
 
-FILE *LOGFILE = stdout;
+static FILE *LOGFILE = stdout;
 
 #define LOGVAR(X)                                   \
     if (DEBUG) {                          \
@@ -16,7 +17,7 @@ FILE *LOGFILE = stdout;
         fflush(dbg::LOGFILE);                       \
     }
 
-void LOG(std::string s) {
+inline void LOG(std::string s) {
     if (DEBUG) {
         fputs(s.c_str(), LOGFILE);
         fflush(LOGFILE);
@@ -40,5 +41,6 @@ void LOGLN(std::string fmt, const Ts &... args) {
 }
 
 } // namespace dbg
+} // namespace eco
 
 #endif
\ No newline at end of file
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "arena.hpp"
+#include "entity.hpp"
+
+/**
+ * density.hpp
+ *
+ * Per-tile entity counts for answering "how many X in this rectangle"
+ * without scanning the grid.
+ *
+ * The grid interior is split into TILE x TILE tiles, and each tile keeps a
+ * 64-bit mask per entity type of the cells holding it, a byte per row. The
+ * engines report every change of a cell's type through change(), which moves
+ * the cell's bit between masks and flags the tile dirty. Engines partition rows on tile boundaries (see
+ * schedule.hpp), so each tile only ever has one writer and none of this needs
+ * atomics.
+ *
+ * Queries go through a 2D Fenwick tree over the tiles, one per entity type.
+ * It is brought up to date lazily, only on the first query after the grid
+ * changed, by a scan of the dirty flags: a byte per tile, so a 64th of a pass
+ * over the grid. The update phases pay a compare and two bit flips per type
+ * change and nothing else.
+ *
+ * A query costs O(log^2 tiles) for the tile-aligned part of the rectangle.
+ * The tiles its edges cut through are counted from their masks, one popcount
+ * each whatever the rows and columns covered, so about perimeter / TILE more.
+ * Queries must not run concurrently with an update.
+ */
+
+namespace eco {
+
+struct DensityIndex {
+    static constexpr int TILE = 8;
+    static_assert(TILE * TILE == 64, "a tile's cells are the bits of a uint64_t");
+
+    int tilesH;
+    int tilesW;
+    int tiles;
+
+    uint64_t* cells;     // [tile][type], bit TILE * row + col, maintained during updates
+    int32_t* published;  // [tile][type], what the Fenwick trees hold
+    uint8_t* dirty;      // Whether a tile changed since the last refresh
+    int64_t* tree;       // [type][(tilesH + 1) * (tilesW + 1)], 1-based
+
+    DensityIndex() = delete;
+    DensityIndex(const DensityIndex&) = delete;
+    DensityIndex(int h, int w, Arena& arena);
+
+    static size_t bytes(int h, int w);
+
+    inline void change(int x, int y, Entity_t from, Entity_t to);
+    void refresh();
+    int64_t count(Entity_t type, int r0, int c0, int r1, int c1);
+
+    int64_t prefix(Entity_t type, int tr, int tc) const;
+    int64_t partial(Entity_t type, int r0, int c0, int r1, int c1) const;
+    static uint64_t mask(int r0, int c0, int r1, int c1);
+};
+
+inline DensityIndex::DensityIndex(int h, int w, Arena& arena)
+    : tilesH((h + TILE - 1) / TILE),
+      tilesW((w + TILE - 1) / TILE),
+      tiles(tilesH * tilesW),
+      cells(arena.allocate<uint64_t>(static_cast<size_t>(tiles) * ENTITY_TYPES_N)),
+      published(arena.allocate<int32_t>(static_cast<size_t>(tiles) * ENTITY_TYPES_N)),
+      dirty(arena.allocate<uint8_t>(tiles)),
+      tree(arena.allocate<int64_t>(ENTITY_TYPES_N * static_cast<size_t>(tilesH + 1) *
+                                   (tilesW + 1))) {
+    if (!arena.ok())
+        return;
+
+    // Everything starts out empty, published on the first refresh
+    for (int tile = 0; tile < tiles; ++tile) {
+        const int tr = tile / tilesW, tc = tile % tilesW;
+        const int rows = (tr + 1) * TILE < h ? TILE : h - tr * TILE;
+        const int cols = (tc + 1) * TILE < w ? TILE : w - tc * TILE;
+        cells[tile * ENTITY_TYPES_N + EMPTY] = mask(0, 0, rows, cols);
+        dirty[tile] = 1;
+    }
+}
+
+inline size_t DensityIndex::bytes(int h, int w) {
+    const size_t tiles = static_cast<size_t>((h + TILE - 1) / TILE) * ((w + TILE - 1) / TILE);
+    const size_t nodes = static_cast<size_t>((h + TILE - 1) / TILE + 1) *
+                         ((w + TILE - 1) / TILE + 1);
+    return Arena::align(tiles * ENTITY_TYPES_N * sizeof(uint64_t)) +
+           Arena::align(tiles * ENTITY_TYPES_N * sizeof(int32_t)) +
+           Arena::align(tiles) +
+           Arena::align(ENTITY_TYPES_N * nodes * sizeof(int64_t));
+}
+
+/**
+ * Records that interior cell (x, y) of the grid, in matrix coordinates,
+ * went from holding a from to holding a to
+ */
+inline void DensityIndex::change(int x, int y, Entity_t from, Entity_t to) {
+    const int tile = ((x - 1) / TILE) * tilesW + (y - 1) / TILE;
+    const uint64_t bit = uint64_t(1) << ((x - 1) % TILE * TILE + (y - 1) % TILE);
+    cells[tile * ENTITY_TYPES_N + from] &= ~bit;
+    cells[tile * ENTITY_TYPES_N + to] |= bit;
+    if (!dirty[tile])
+        dirty[tile] = 1;
+}
+
+/**
+ * Pushes the tiles changed since the last refresh into the Fenwick trees
+ */
+inline void DensityIndex::refresh() {
+    const int stride = tilesW + 1;
+    for (int tile = 0; tile < tiles; ++tile) {
+        if (!dirty[tile])
+            continue;
+        const int tr = tile / tilesW, tc = tile % tilesW;
+        for (size_t t = 0; t < ENTITY_TYPES_N; ++t) {
+            const int d = __builtin_popcountll(cells[tile * ENTITY_TYPES_N + t]) -
+                          published[tile * ENTITY_TYPES_N + t];
+            if (d == 0)
+                continue;
+            published[tile * ENTITY_TYPES_N + t] += d;
+            int64_t* fen = tree + t * (tilesH + 1) * stride;
+            for (int i = tr + 1; i <= tilesH; i += i & -i)
+                for (int j = tc + 1; j <= tilesW; j += j & -j)
+                    fen[i * stride + j] += d;
+        }
+        dirty[tile] = 0;
+    }
+}
+
+// Sum over tiles [0, tr) x [0, tc)
+inline int64_t DensityIndex::prefix(Entity_t type, int tr, int tc) const {
+    const int stride = tilesW + 1;
+    const int64_t* fen = tree + static_cast<size_t>(type) * (tilesH + 1) * stride;
+    int64_t sum = 0;
+    for (int i = tr; i > 0; i -= i & -i)
+        for (int j = tc; j > 0; j -= j & -j)
+            sum += fen[i * stride + j];
+    return sum;
+}
+
+// Bits of rows [r0, r1) and columns [c0, c1) of a tile, both ranges non-empty
+inline uint64_t DensityIndex::mask(int r0, int c0, int r1, int c1) {
+    const uint64_t rows = ~uint64_t(0) >> (64 - TILE * (r1 - r0)) << (TILE * r0);
+    const uint64_t cols = ((1u << c1) - (1u << c0)) * 0x0101010101010101ull;
+    return rows & cols;
+}
+
+// Count over rows [r0, r1) and columns [c0, c1), one popcount per tile touched
+inline int64_t DensityIndex::partial(Entity_t type, int r0, int c0, int r1,
+                                     int c1) const {
+    int64_t k = 0;
+    for (int tr = r0 / TILE; tr * TILE < r1; ++tr) {
+        const int a0 = std::max(r0 - tr * TILE, 0), a1 = std::min(r1 - tr * TILE, TILE);
+        for (int tc = c0 / TILE; tc * TILE < c1; ++tc) {
+            const int b0 = std::max(c0 - tc * TILE, 0), b1 = std::min(c1 - tc * TILE, TILE);
+            k += __builtin_popcountll(cells[(tr * tilesW + tc) * ENTITY_TYPES_N + type] &
+                                      mask(a0, b0, a1, b1));
+        }
+    }
+    return k;
+}
+
+/**
+ * Number of cells holding type in interior rows [r0, r1) and columns
+ * [c0, c1), 0-based as in the text format
+ */
+inline int64_t DensityIndex::count(Entity_t type, int r0, int c0, int r1, int c1) {
+    if (r0 >= r1 || c0 >= c1)
+        return 0;
+
+    refresh();
+
+    // Fully covered tiles
+    const int tr0 = (r0 + TILE - 1) / TILE, tr1 = r1 / TILE;
+    const int tc0 = (c0 + TILE - 1) / TILE, tc1 = c1 / TILE;
+
+    if (tr0 >= tr1 || tc0 >= tc1)
+        return partial(type, r0, c0, r1, c1);
+
+    const int ir0 = tr0 * TILE, ir1 = tr1 * TILE;
+    const int ic0 = tc0 * TILE, ic1 = tc1 * TILE;
+
+    return prefix(type, tr1, tc1) - prefix(type, tr0, tc1) -
+           prefix(type, tr1, tc0) + prefix(type, tr0, tc0) +
+           partial(type, r0, c0, ir0, c1) + partial(type, ir1, c0, r1, c1) +
+           partial(type, ir0, c0, ir1, ic0) + partial(type, ir0, ic1, ir1, c1);
+}
+
+} // namespace eco
@@ -0,0 +1,305 @@
+#define DEBUG 0
+
+#include <algorithm>
+#include <climits>
+#include <new>
+#include <string>
+
+#if defined(PULL)
+#include "omp.h"
+#include "world_pull.hpp"
+#elif defined(_OPENMP)
+#include "omp.h"
+#include "world_queue.hpp"
+#else
+#include "world_sequential.hpp"
+#endif
+
+#include "autotune.hpp"
+#include "ecosystem.h"
+#include "entity.hpp"
+#include "schedule.hpp"
+#include "snapshot.hpp"
+
+using namespace eco;
+
+static_assert(sizeof(eco_cell) == sizeof(Entity) &&
+              offsetof(eco_cell, type) == offsetof(Entity, type) &&
+              offsetof(eco_cell, age) == offsetof(Entity, age) &&
+              offsetof(eco_cell, hunger) == offsetof(Entity, hunger),
+              "eco_cell must mirror Entity so grid views need no copy");
+
+static_assert(ECO_TYPES_N == ENTITY_TYPES_N && ECO_RABBIT == int{RABBIT} &&
+              ECO_FOX == int{FOX} && ECO_ROCK == int{ROCK},
+              "eco_type must mirror Entity_t");
+
+/**
+ * Where eco_params keeps each species' ages. A species added to Ecosystem
+ * without its fields here doesn't compile
+ */
+template <class S>
+struct ParamsOf;
+
+template <>
+struct ParamsOf<Rabbits> {
+    static int genProc(const eco_params& p) { return p.gen_proc_rabbits; }
+    static int genFood(const eco_params&) { return 0; }
+};
+
+template <>
+struct ParamsOf<Foxes> {
+    static int genProc(const eco_params& p) { return p.gen_proc_foxes; }
+    static int genFood(const eco_params& p) { return p.gen_food_foxes; }
+};
+
+// The ages the C API takes, by Entity_t
+static SpeciesTable speciesOf(const eco_params& p) {
+    SpeciesTable species{};
+    Ecosystem::forEach([&](auto tag) {
+        using S = typename decltype(tag)::type;
+        species[S::type] = {ParamsOf<S>::genProc(p), ParamsOf<S>::genFood(p)};
+    });
+    return species;
+}
+
+struct eco_world {
+    World world;
+    FILE* snapshotFile;
+
+    explicit eco_world(const eco_params& p)
+        : world(speciesOf(p), p.width, p.height, 0), snapshotFile(nullptr) {}
+
+#ifdef PULL
+    eco_world(const eco_params& p, const char* store)
+        : world(speciesOf(p), p.width, p.height, 0, World::defaultThreads(), store),
+          snapshotFile(nullptr) {}
+#endif
+
+    // The parallel engines keep their barrier on cache lines of its own, an
+    // alignment plain new only honours from C++17 on
+    static void* operator new(size_t size, const std::nothrow_t&) noexcept {
+        void* p = nullptr;
+        return posix_memalign(&p, std::max(alignof(eco_world), sizeof(void*)), size) == 0
+                   ? p
+                   : nullptr;
+    }
+    static void operator delete(void* p) noexcept { free(p); }
+};
+
+int eco_api_version(void) {
+    return ECO_API_VERSION;
+}
+
+/**
+ * Whether the engines can index an h x w world. Cells are addressed with
+ * size_t, but coordinates, with the border, and density tile numbers are ints
+ */
+static bool supported(int h, int w) {
+    if (h > INT_MAX - 2 || w > INT_MAX - 2)
+        return false;
+    const int64_t tilesH = h / DensityIndex::TILE + 2;
+    const int64_t tilesW = w / DensityIndex::TILE + 2;
+    return tilesH * tilesW <= INT_MAX;
+}
+
+// Whether type is an eco_type and (row, col) a cell of an h x w grid
+static bool placeable(int type, int row, int col, int h, int w) {
+    return type >= ECO_EMPTY && type < ECO_TYPES_N && row >= 0 && row < h && col >= 0 &&
+           col < w;
+}
+
+static bool valid(const eco_params* params, const eco_placement* placements,
+                  size_t count) {
+    if (params == nullptr || params->height <= 0 || params->width <= 0 ||
+        !supported(params->height, params->width) ||
+        (count > 0 && placements == nullptr))
+        return false;
+
+    for (size_t i = 0; i != count; ++i) {
+        const eco_placement& p = placements[i];
+        if (!placeable(p.type, p.row, p.col, params->height, params->width))
+            return false;
+    }
+    return true;
+}
+
+static void populate(eco_world* w, const eco_placement* placements, size_t count) {
+    w->world.entity_count = static_cast<int>(count);
+    w->world.init();
+    for (size_t i = 0; i != count; ++i)
+        w->world.add(static_cast<Entity_t>(placements[i].type), placements[i].row,
+                     placements[i].col);
+}
+
+eco_world* eco_create(const eco_params* params, const eco_placement* placements,
+                      size_t count) {
+    if (!valid(params, placements, count))
+        return nullptr;
+
+    eco_world* w = new (std::nothrow) eco_world(*params);
+    if (w == nullptr)
+        return nullptr;
+    if (!w->world.arena.ok()) {
+        delete w;
+        return nullptr;
+    }
+    populate(w, placements, count);
+    return w;
+}
+
+eco_world* eco_create_streaming(const eco_params* params,
+                                const eco_placement* placements, size_t count,
+                                const char* store_path, int band_rows) {
+#ifdef PULL
+    if (!valid(params, placements, count) || store_path == nullptr || band_rows < 0)
+        return nullptr;
+
+    eco_world* w = new (std::nothrow) eco_world(*params, store_path);
+    if (w == nullptr)
+        return nullptr;
+    if (!w->world.arena.ok()) {
+        delete w;
+        return nullptr;
+    }
+    if (band_rows > 0)
+        w->world.setStreamBand(band_rows);
+    populate(w, placements, count);
+    return w;
+#else
+    (void)params, (void)placements, (void)count, (void)store_path, (void)band_rows;
+    return nullptr;
+#endif
+}
+
+int eco_place(eco_world* world, eco_type type, int row, int col) {
+    World& w = world->world;
+    if (!placeable(type, row, col, w.height - 1, w.width - 1))
+        return -1;
+    w.add(static_cast<Entity_t>(type), row, col);
+    ++w.entity_count;
+    return 0;
+}
+
+void eco_destroy(eco_world* world) {
+    if (world != nullptr)
+        eco_snapshots_stop(world);
+    delete world;
+}
+
+void eco_step(eco_world* world, int generations) {
+    // The engines count generations in an int
+    generations = std::min(generations, INT_MAX - world->world.current_gen);
+    if (generations > 0)
+        world->world.run(generations);
+}
+
+int eco_generation(const eco_world* world) {
+    return world->world.current_gen;
+}
+
+eco_grid_view eco_grid(const eco_world* world) {
+    const World& w = world->world;
+    return {reinterpret_cast<const eco_cell*>(&w.map(1, 1)), w.height - 1,
+            w.width - 1, w.map.width};
+}
+
+const int64_t* eco_population(const eco_world* world) {
+    return world->world.population;
+}
+
+static eco_schedule toEco(const Schedule& s) {
+    return {s.threads, s.balanced ? 1 : 0, s.band};
+}
+
+eco_schedule eco_autotune(eco_world* world, int trial_generations,
+                          const char* cache_path) {
+    return toEco(autotune(world->world, std::max(trial_generations, 1), cache_path));
+}
+
+eco_schedule eco_get_schedule(const eco_world* world) {
+#ifdef _OPENMP
+    return toEco(world->world.schedule);
+#else
+    (void)world;
+    return toEco(defaultSchedule(1));
+#endif
+}
+
+void eco_set_schedule(eco_world* world, const eco_schedule* schedule) {
+#ifdef _OPENMP
+    world->world.setSchedule({schedule->threads, schedule->balanced != 0, schedule->band});
+#else
+    (void)world, (void)schedule;
+#endif
+}
+
+int64_t eco_count_region(eco_world* world, eco_type type, int row0, int col0,
+                         int row1, int col1) {
+    World& w = world->world;
+    if (type < ECO_EMPTY || type >= ECO_TYPES_N)
+        return 0;
+    row0 = std::max(row0, 0), col0 = std::max(col0, 0);
+    row1 = std::min(row1, w.height - 1), col1 = std::min(col1, w.width - 1);
+    return w.countRegion(static_cast<Entity_t>(type), row0, col0, row1, col1);
+}
+
+int eco_snapshots_start(eco_world* world, const char* path, int every,
+                        int inflight) {
+    if (path == nullptr || every <= 0 || inflight <= 0)
+        return -1;
+
+    World& w = world->world;
+#ifdef PULL
+    // Frames are copied from the whole grid at once, which streaming can't page in
+    if (w.streamBand > 0)
+        return -1;
+#endif
+
+    eco_snapshots_stop(world);
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+        return -1;
+
+    SnapshotWriter* writer =
+        new (std::nothrow) SnapshotWriter(file, w.height - 1, w.width - 1, inflight);
+    if (writer == nullptr || !writer->ok()) {
+        delete writer;
+        fclose(file);
+        return -1;
+    }
+
+    world->snapshotFile = file;
+    w.snapshots = writer;
+    w.snapshot_every = every;
+    w.snapshot_start = w.current_gen;
+    w.snapshots->capture(w.map, w.current_gen);
+    return 0;
+}
+
+int eco_snapshots_stop(eco_world* world) {
+    World& w = world->world;
+    if (w.snapshots == nullptr)
+        return 0;
+
+    w.snapshots->finish();
+    bool failed = w.snapshots->failed();
+    delete w.snapshots;
+    w.snapshots = nullptr;
+    w.snapshot_every = 0;
+    if (fclose(world->snapshotFile) != 0)
+        failed = true;
+    world->snapshotFile = nullptr;
+    return failed ? -1 : 0;
+}
+
+eco_type eco_type_from_name(const char* name) {
+    if (name == nullptr)
+        return ECO_EMPTY;
+    return static_cast<eco_type>(makeEntity(std::string(name)).type);
+}
+
+const char* eco_type_name(eco_type type) {
+    if (type < ECO_EMPTY || type >= ECO_TYPES_N)
+        return nullptr;
+    return ENTITY_NAME[static_cast<size_t>(type)].c_str();
+}
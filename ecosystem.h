@@ -0,0 +1,173 @@
+#ifndef ECOSYSTEM_H
+#define ECOSYSTEM_H
+
+/**
+ * ecosystem.h
+ *
+ * C interface to the simulation engine, built as libecosystem.a / .so.
+ *
+ * A world is created from in-memory parameters and entity placements, stepped
+ * any number of generations and inspected through views that point straight
+ * into the engine's own buffers. Views stay valid for the lifetime of the
+ * world; their contents change when the world is stepped, so don't read them
+ * concurrently with eco_step.
+ *
+ * Which engine backs the library (sequential, queue or pull) is decided when
+ * it is compiled, as for the ecosystem binary.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ECO_API_VERSION 3
+
+/*
+ * The shared library is built with hidden visibility, so only what is marked
+ * ECO_API is exported; the engine behind it stays internal
+ */
+#if defined(__GNUC__)
+#define ECO_API __attribute__((visibility("default")))
+#else
+#define ECO_API
+#endif
+
+typedef enum { ECO_EMPTY, ECO_RABBIT, ECO_FOX, ECO_ROCK, ECO_TYPES_N } eco_type;
+
+typedef struct eco_world eco_world;
+
+typedef struct {
+    int gen_proc_rabbits;  /* Generations until a rabbit can procreate */
+    int gen_proc_foxes;    /* As above but for foxes */
+    int gen_food_foxes;    /* Generations a fox can go without food */
+    int height;
+    int width;
+} eco_params;
+
+typedef struct {
+    int32_t type;  /* eco_type */
+    int32_t row;
+    int32_t col;
+} eco_placement;
+
+/* One grid cell, laid out exactly like the engine's own cells */
+typedef struct {
+    uint8_t type;  /* eco_type */
+    int16_t age;
+    int16_t hunger;
+} eco_cell;
+
+typedef struct {
+    const eco_cell* cells;  /* Cell (0, 0) */
+    int height;
+    int width;
+    int stride;             /* Cells from the start of one row to the next */
+} eco_grid_view;
+
+/* How a parallel engine splits the grid between threads */
+typedef struct {
+    int threads;
+    int balanced;  /* Blocks balanced by estimated work instead of row count */
+    int band;      /* Blocks start on multiples of this many rows */
+} eco_schedule;
+
+ECO_API int eco_api_version(void);
+
+/*
+ * Returns NULL if the parameters or any placement are out of range, if the
+ * grid has more than about 2^37 cells, or if there isn't enough memory for it.
+ * placements may be NULL if count is 0, for a world to fill with eco_place
+ */
+ECO_API eco_world* eco_create(const eco_params* params,
+                              const eco_placement* placements, size_t count);
+
+/*
+ * Like eco_create, but the world lives in the file at store_path (created or
+ * truncated) rather than in memory, for grids larger than RAM. Generations are
+ * computed in bands of band_rows rows (0 for a few MB worth) and only the
+ * bands being worked on need to be resident. Cycle fast-forwarding is off, as
+ * is eco_autotune. Returns NULL if the store can't be created, or if the
+ * library wasn't built with the pull engine, the only one that can stream.
+ * Create it empty and eco_place its entities to avoid holding them all in
+ * memory first.
+ */
+ECO_API eco_world* eco_create_streaming(const eco_params* params,
+                                        const eco_placement* placements,
+                                        size_t count, const char* store_path,
+                                        int band_rows);
+
+/*
+ * Puts an entity of type at (row, col), replacing whatever was there, for
+ * filling a world one entity at a time. Also allowed between eco_step calls.
+ * Returns 0, or -1 if type, row or col is out of range
+ */
+ECO_API int eco_place(eco_world* world, eco_type type, int row, int col);
+ECO_API void eco_destroy(eco_world* world);
+
+/*
+ * Steps the world, stopping early at generation INT_MAX, past which
+ * eco_generation couldn't count
+ */
+ECO_API void eco_step(eco_world* world, int generations);
+ECO_API int eco_generation(const eco_world* world);
+
+ECO_API eco_grid_view eco_grid(const eco_world* world);
+
+/* Number of cells holding each eco_type, indexed by eco_type */
+ECO_API const int64_t* eco_population(const eco_world* world);
+
+/*
+ * Times trial_generations generations of candidate schedules on a copy of the
+ * world, or of a sample of about a million cells of larger ones, and keeps the
+ * fastest. Streaming worlds keep their schedule. If cache_path is not NULL the
+ * choice is looked up in, and otherwise appended to, that file keyed by
+ * engine, grid shape and the world's thread budget; entries for anything else
+ * are ignored.
+ */
+ECO_API eco_schedule eco_autotune(eco_world* world, int trial_generations,
+                                  const char* cache_path);
+ECO_API eco_schedule eco_get_schedule(const eco_world* world);
+ECO_API void eco_set_schedule(eco_world* world, const eco_schedule* schedule);
+
+/*
+ * Number of cells holding type in rows [row0, row1) and columns [col0, col1),
+ * answered from an index of 8x8 tiles rather than a scan of the grid. The
+ * whole tiles inside the rectangle cost O(log^2 tiles), and each tile its
+ * edges cut through one popcount of a bitmask of its cells. The first query
+ * after eco_step also reads a byte per tile to pick up what changed
+ */
+ECO_API int64_t eco_count_region(eco_world* world, eco_type type, int row0,
+                                 int col0, int row1, int col1);
+
+/*
+ * Appends a frame of the grid to the file at path now, at generation g, and
+ * then at generations g + every, g + 2 * every and so on. Frames are compressed and written by a background thread while
+ * the world keeps stepping; once `inflight` frames are waiting for it eco_step
+ * waits too. Cycle fast-forwarding is off while snapshots are taken. Returns 0,
+ * or -1 if the arguments are invalid, the file can't be opened, there isn't
+ * memory for the frames or the world is streaming. The frame format is
+ * described in snapshot.hpp.
+ */
+ECO_API int eco_snapshots_start(eco_world* world, const char* path, int every,
+                                int inflight);
+/*
+ * Waits for pending frames to be written and closes the file. Returns 0, or -1
+ * if any frame couldn't be written
+ */
+ECO_API int eco_snapshots_stop(eco_world* world);
+
+/*
+ * Upper case names as used by the text format ("RABBIT"). Unknown names and
+ * NULL map to ECO_EMPTY, and types outside eco_type have no name (NULL)
+ */
+ECO_API eco_type eco_type_from_name(const char* name);
+ECO_API const char* eco_type_name(eco_type type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
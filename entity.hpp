@@ -8,6 +8,8 @@
 
 using namespace std::literals;
 
+namespace eco {
+
 enum Entity_t : uint8_t { EMPTY, RABBIT, FOX, ROCK };
 constexpr size_t ENTITY_TYPES_N = 4;
 
@@ -17,10 +19,10 @@ struct Entity {
     short hunger;   // How many generations since it last ate
 };
 
- std::array<std::string, ENTITY_TYPES_N> ENTITY_NAME = {
+static const std::array<std::string, ENTITY_TYPES_N> ENTITY_NAME = {
     "EMPTY", "RABBIT", "FOX", "ROCK"};
 
- std::array<char, ENTITY_TYPES_N> ENTITY_SYMBOL = {
+static const std::array<char, ENTITY_TYPES_N> ENTITY_SYMBOL = {
     ' ', 'R', 'F', '*'};
 
 inline  Entity makeEntity(const Entity_t t) {
@@ -51,4 +53,6 @@ inline void printEntity(const Entity& e) {
 
 inline void printEntity(const Entity_t e) {
     std::cout << ENTITY_SYMBOL[static_cast<size_t>(e)];
-}
\ No newline at end of file
+}
+
+} // namespace eco
@@ -1,55 +1,137 @@
-#define DEBUG 0
-
-#include <omp.h>
-#include <algorithm>
 #include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <limits>
-#include <vector>
-
-#ifdef _OPENMP
-#include "omp.h"
-#include "world_queue.hpp"
-#else
-#include "world_sequential.hpp"
-#endif
+#include <string>
 
-#include "debug.hpp"
-#include "entity.hpp"
-#include "malloc.h"
-#include "matrix.hpp"
+#include "ecosystem.h"
 
 using namespace std::chrono;
 
-void readEntities(World& world) {
-    for (int i = 0; i != world.entity_count; ++i) {
-        int x, y;
+// Places entities straight from the input, so they never all sit in memory
+bool placeEntities(eco_world* world, int count) {
+    for (int i = 0; i < count; ++i) {
         std::string o;
-        std::cin >> o >> x >> y;
-        world.add(o, x, y);
+        int row, col;
+        std::cin >> o >> row >> col;
+        if (!std::cin || eco_place(world, eco_type_from_name(o.c_str()), row, col) != 0)
+            return false;
+    }
+    return true;
+}
+
+void printText(const eco_grid_view& grid) {
+    for (int i = 0; i < grid.height; ++i) {
+        const eco_cell* row = grid.cells + i * grid.stride;
+        for (int j = 0; j < grid.width; ++j) {
+            if (row[j].type != ECO_EMPTY)
+                std::cout << eco_type_name(static_cast<eco_type>(row[j].type))
+                          << ' ' << i << ' ' << j << '\n';
+        }
     }
 }
 
-int main() {
+// Reads a whole decimal number of at least min from s
+bool parseInt(const char* s, int min, int& out) {
+    char* end;
+    const long v = std::strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v < min || v > INT_MAX)
+        return false;
+    out = static_cast<int>(v);
+    return true;
+}
+
+/**
+ * Options:
+ *     --autotune          Pick the thread count and row split by timing a few
+ *                         generations before the run
+ *     --tune-cache=FILE   Reuse and record autotune choices in FILE
+ *     --snapshot=FILE     Write frames of the grid to FILE while running (not
+ *                         with --store)
+ *     --snapshot-every=K  Generations between frames, 1 by default
+ *     --store=FILE        Keep the world in FILE instead of memory (pull engine)
+ *     --store-band=ROWS   Rows processed at a time when using --store
+ */
+int main(int argc, char** argv) {
     std::ios_base::sync_with_stdio(false);
     std::cin.tie(NULL);
 
-    int gen_proc_rabbits, gen_proc_foxes, gen_food_foxes;
-    int height, width, count, n_gen;
+    bool tune = false;
+    const char* tuneCache = nullptr;
+    const char* snapshotFile = nullptr;
+    int snapshotEvery = 1;
+    const char* store = nullptr;
+    int storeBand = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--autotune") == 0)
+            tune = true;
+        else if (std::strncmp(argv[i], "--tune-cache=", 13) == 0)
+            tune = true, tuneCache = argv[i] + 13;
+        else if (std::strncmp(argv[i], "--snapshot=", 11) == 0)
+            snapshotFile = argv[i] + 11;
+        else if (std::strncmp(argv[i], "--snapshot-every=", 17) == 0) {
+            if (!parseInt(argv[i] + 17, 1, snapshotEvery)) {
+                std::cerr << "--snapshot-every needs a positive number of generations\n";
+                return 1;
+            }
+        }
+        else if (std::strncmp(argv[i], "--store=", 8) == 0)
+            store = argv[i] + 8;
+        else if (std::strncmp(argv[i], "--store-band=", 13) == 0) {
+            if (!parseInt(argv[i] + 13, 0, storeBand)) {
+                std::cerr << "--store-band needs a number of rows (0 for the default)\n";
+                return 1;
+            }
+        }
+    }
 
-    std::cin >> gen_proc_rabbits >> gen_proc_foxes >> gen_food_foxes >> n_gen >>
-        width >> height >> count;
+#ifndef PULL
+    if (store != nullptr) {
+        std::cerr << "--store needs the pull engine (make pull)\n";
+        return 1;
+    }
+#endif
+
+    eco_params params;
+    int count, n_gen;
+
+    std::cin >> params.gen_proc_rabbits >> params.gen_proc_foxes >>
+        params.gen_food_foxes >> n_gen >> params.width >> params.height >> count;
+
+    eco_world* world = store != nullptr
+                           ? eco_create_streaming(&params, nullptr, 0, store, storeBand)
+                           : eco_create(&params, nullptr, 0);
+    if (world == nullptr) {
+        if (store != nullptr)
+            std::cerr << "Invalid world, or can't create " << store << '\n';
+        else
+            std::cerr << "Invalid world\n";
+        return 1;
+    }
+    if (!placeEntities(world, count)) {
+        std::cerr << "Invalid entity in the input\n";
+        eco_destroy(world);
+        return 1;
+    }
 
-    World world(gen_proc_rabbits, gen_proc_foxes, gen_food_foxes, n_gen, width,
-                height, count);
+    if (tune) {
+        const eco_schedule s = eco_autotune(world, 5, tuneCache);
+        std::cerr << "schedule: " << s.threads << " threads, "
+                  << (s.balanced ? "balanced" : "even") << ", band "
+                  << s.band << '\n';
+    }
 
-    world.init();
-    readEntities(world);
+    if (snapshotFile != nullptr &&
+        eco_snapshots_start(world, snapshotFile, snapshotEvery, 4) != 0) {
+        std::cerr << "Can't write snapshots to " << snapshotFile << '\n';
+        return 1;
+    }
 
     auto t1 = high_resolution_clock::now();
 
-    while (n_gen--) 
-        world.update();
+    eco_step(world, n_gen);
+    const bool snapshotsWritten = eco_snapshots_stop(world) == 0;
 
     auto t2 = high_resolution_clock::now();
 
@@ -57,12 +139,20 @@ int main() {
               << duration_cast<milliseconds>(t2 - t1).count() << "ms, "
               << duration_cast<seconds>(t2 - t1).count()      << "s\n";
 
-    std::cout << gen_proc_rabbits << ' ' << gen_proc_foxes << ' '
-              << gen_food_foxes   << ' ' << 0              << ' ' 
-              << height           << ' ' << width          << ' '
-              << world.countEntities()   << '\n';
+    const int64_t* population = eco_population(world);
 
-    world.printText();
+    std::cout << params.gen_proc_rabbits << ' ' << params.gen_proc_foxes << ' '
+              << params.gen_food_foxes   << ' ' << 0              << ' ' 
+              << params.height           << ' ' << params.width   << ' '
+              << int64_t{params.height} * params.width - population[ECO_EMPTY]
+              << '\n';
 
+    printText(eco_grid(world));
+
+    eco_destroy(world);
+    if (!snapshotsWritten) {
+        std::cerr << "Failed writing snapshots to " << snapshotFile << '\n';
+        return 1;
+    }
     return 0;
 }
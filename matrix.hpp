@@ -1,42 +1,58 @@
 #pragma once
 
-#include <vector>
-#include <utility>
 #include <algorithm>
+#include <type_traits>
+
+#include "arena.hpp"
+
+namespace eco {
 
 /**
- * Wrapper around std::vector
+ * Row-major grid whose storage lives in an Arena
  * 
  * Defines operator (int, int) so we can access matrix positions by coordinate
  */
 
 template <class T>
 struct Matrix {
-    using Container = std::vector<T>;
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Matrix storage is raw arena memory");
 
-    Container arr;
+    T* arr;
 
     int height;
     int width;
-    int size;
+    size_t size;
 
     Matrix()  = delete;
     ~Matrix() = default;
+    Matrix(const Matrix<T>&) = delete;
+
+    Matrix(int h, int w, Arena& arena)
+        : arr(arena.allocate<T>(static_cast<size_t>(h) * w)),
+          height(h), width(w), size(static_cast<size_t>(h) * w) {}
 
-    Matrix(int h, int w) : height(h), width(w), size(h * w) {
-        arr.resize(size);
+    static size_t bytes(int h, int w) {
+        return Arena::align(static_cast<size_t>(h) * w * sizeof(T));
     }
 
     inline T& operator()(int row, int col) { 
-        return arr[row * width + col]; 
+        return arr[static_cast<size_t>(row) * width + col]; 
     }
 
     inline const T& operator()(int row, int col) const {
-        return arr[row * width + col];
+        return arr[static_cast<size_t>(row) * width + col];
     }
 
     inline void operator=(const Matrix<T> &other) {
-        arr = other.arr;
+        std::copy(other.arr, other.arr + size, arr);
+    }
+
+    // Copies rows [first, last) of other into this matrix
+    inline void copyRows(const Matrix<T> &other, int first, int last) {
+        std::copy(other.arr + static_cast<size_t>(first) * width,
+                  other.arr + static_cast<size_t>(last) * width,
+                  arr + static_cast<size_t>(first) * width);
     }
 };
 
@@ -77,4 +93,6 @@ struct Matrix {
 //             for (int j = 0; j != width; ++j) 
 //                 arr[i][j] = std::forward<const T>(other(i,j));
 //     }
-// };
\ No newline at end of file
+// };
+
+} // namespace eco
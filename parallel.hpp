@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+
+#include "arena.hpp"
+#include "cycle.hpp"
+#include "density.hpp"
+#include "entity.hpp"
+#include "omp.h"
+#include "schedule.hpp"
+#include "snapshot.hpp"
+
+/**
+ * parallel.hpp
+ *
+ * What the queue and pull engines share around their kernels: splitting the
+ * rows between threads and driving a run of generations.
+ *
+ * A run happens inside a single parallel region, the threads meeting at the
+ * engine's spin barrier instead of forking and joining every generation. The
+ * engine's step() computes one generation across the team. Thread 0 then does
+ * the bookkeeping while the others wait at the barrier: merging the threads'
+ * hash and population changes, advancing current_gen, fast-forwarding and
+ * acquiring a snapshot slot. So every thread sees the same current_gen when
+ * deciding whether to keep going.
+ *
+ * The engine provides step<TrackHash>(th, sense), which only maintains the
+ * hash if TrackHash is set, and partition(threads), which must call
+ * splitRows, along with the members used below.
+ */
+
+namespace eco {
+
+// Per-thread hash and population changes made during a generation
+struct alignas(CACHE_LINE) ThreadDelta {
+    uint64_t hash;
+    int64_t population[ENTITY_TYPES_N];
+};
+
+/**
+ * Splits the rows of w between s.threads threads, and uses that many from
+ * the next run on
+ */
+template <class W>
+void setRowSchedule(W& w, Schedule s) {
+    s.threads = std::max(1, std::min(s.threads, w.max_threads));
+    s.band    = std::max(1, s.band / DensityIndex::TILE) * DensityIndex::TILE;
+
+    w.schedule = s;
+    w.partition(s.threads);
+}
+
+/**
+ * Splits the rows of w between the given number of threads as its schedule
+ * says
+ */
+template <class W>
+void splitRows(W& w, int threads) {
+    Schedule s = w.schedule;
+    s.threads  = threads;
+    w.nthreads = threads;
+    w.barrier.reset(threads);
+
+    partitionRows(w.map, w.height - 1, w.width - 1, s, w.firstRow.data());
+}
+
+template <class W>
+inline void mergeDeltas(W& w) {
+    for (int th = 0; th < w.max_threads; ++th) {
+        w.hash ^= w.delta[th].hash;
+        w.delta[th].hash = 0;
+        for (size_t t = 0; t < ENTITY_TYPES_N; ++t) {
+            w.population[t] += w.delta[th].population[t];
+            w.delta[th].population[t] = 0;
+        }
+    }
+}
+
+/**
+ * Advances w n generations, fast-forwarding once the state repeats or
+ * freezes if detect is set and no snapshots are being taken
+ */
+template <class W>
+void runParallel(W& w, int n, bool detect) {
+    const int target = w.current_gen + n;
+    detect = detect && w.snapshots == nullptr;  // Fast-forwarding would skip snapshots
+    SnapshotWriter::Slot* frame = nullptr;
+
+    if (detect) {
+        w.hash = hashGrid(w.map);
+        w.cycles.reset(w.map, w.hash, w.current_gen);
+    }
+
+    const int requested = w.nthreads;
+
+    #pragma omp parallel num_threads(requested)
+    {
+        // OpenMP can grant fewer threads than asked for (thread limits,
+        // dynamic teams, nested regions), the barrier must only wait for those
+        const int granted = omp_get_num_threads();
+        if (granted != requested) {
+            #pragma omp single
+            w.partition(granted);
+        }
+
+        const int th = omp_get_thread_num();
+        bool sense = w.barrier.sense();
+
+        while (w.current_gen < target) {
+            // The hash is only kept up to date while it can be used
+            if (detect)
+                w.template step<true>(th, sense);
+            else
+                w.template step<false>(th, sense);
+
+            if (th == 0) {
+                mergeDeltas(w);
+                w.current_gen++;
+                if (detect)
+                    fastForward(w, target, detect);
+                // Waits here while the writer is behind
+                if (w.snapshots != nullptr &&
+                    (w.current_gen - w.snapshot_start) % w.snapshot_every == 0)
+                    frame = &w.snapshots->acquire();
+            }
+
+            w.barrier.wait(sense);
+
+            // Each thread freezes its own rows, the map isn't written again
+            // until after the next step's first barrier
+            if (frame != nullptr) {
+                w.snapshots->copyRows(*frame, w.map, w.firstRow[th], w.firstRow[th + 1]);
+                w.barrier.wait(sense);
+                if (th == 0) {
+                    w.snapshots->publish(*frame, w.current_gen);
+                    frame = nullptr;
+                }
+            }
+        }
+    }
+
+    if (w.nthreads != requested)
+        w.partition(requested);
+}
+
+} // namespace eco
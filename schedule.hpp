@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "density.hpp"
+#include "entity.hpp"
+#include "matrix.hpp"
+#include "species.hpp"
+
+/**
+ * schedule.hpp
+ *
+ * How the parallel engines split the grid between threads.
+ *
+ * Every thread gets one contiguous block of rows. Blocks start on multiples
+ * of band rows, which is always a multiple of the density tile height so
+ * tiles keep a single writer. Blocks either hold the same number of bands
+ * or are balanced by an estimate of the work in them, which helps when most
+ * of the entities sit in a few rows.
+ */
+
+namespace eco {
+
+struct Schedule {
+    int threads;
+    bool balanced;
+    int band;
+};
+
+inline Schedule defaultSchedule(int threads) {
+    return {threads, false, DensityIndex::TILE};
+}
+
+/**
+ * Fills firstRow[0..s.threads] with the first row of each block, in matrix
+ * coordinates, for a grid with the given number of interior rows
+ */
+inline void partitionRows(const Matrix<Entity>& map, int rows, int cols,
+                          const Schedule& s, int* firstRow) {
+    const int bands = (rows + s.band - 1) / s.band;
+    auto bandRow = [&](int b) { return 1 + (b * s.band < rows ? b * s.band : rows); };
+
+    if (!s.balanced) {
+        for (int th = 0; th <= s.threads; ++th)
+            firstRow[th] = bandRow(th * bands / s.threads);
+        return;
+    }
+
+    // Every cell is scanned, every animal is updated, the latter costing
+    // roughly as much as a handful of scanned cells
+    constexpr int64_t ENTITY_COST = 8;
+    std::vector<int64_t> cost(bands + 1, 0);
+    for (int b = 0; b < bands; ++b) {
+        int64_t c = 0;
+        for (int i = bandRow(b); i < bandRow(b + 1); ++i)
+            for (int j = 1; j <= cols; ++j)
+                c += 1 + ENTITY_COST * Ecosystem::contains(map(i, j).type);
+        cost[b + 1] = cost[b] + c;
+    }
+
+    int b = 0;
+    firstRow[0] = bandRow(0);
+    for (int th = 1; th < s.threads; ++th) {
+        const int64_t goal = cost[bands] * th / s.threads;
+        while (b < bands && cost[b] < goal)
+            ++b;
+        firstRow[th] = bandRow(b);
+    }
+    firstRow[s.threads] = bandRow(bands);
+}
+
+} // namespace eco
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "arena.hpp"
+#include "entity.hpp"
+#include "matrix.hpp"
+
+/**
+ * snapshot.hpp
+ *
+ * Writes frames of the grid from a background thread so the simulation
+ * doesn't stop while they are compressed and written.
+ *
+ * At a generation boundary the engine acquires a slot, copies the cell types
+ * of the grid into it (threads copy their own rows) and publishes it. The
+ * writer thread run-length encodes published slots and appends them to the
+ * output file while the simulation carries on. There is a fixed number of
+ * slots, all reserved up front; when every one of them is in flight acquire()
+ * blocks until the writer frees one, so a slow disk slows the simulation
+ * down instead of growing memory. If a write fails the writer stops writing
+ * but keeps freeing slots, and failed() says so once it has finished.
+ *
+ * Each frame in the file is
+ *
+ *     "ECOF" generation height width    (little endian int32s)
+ *     payload-bytes                     (little endian uint64)
+ *     payload: (run length as a LEB128 varint, cell type byte) pairs
+ *
+ * covering the interior cells in row-major order.
+ */
+
+namespace eco {
+
+struct SnapshotWriter {
+    struct Slot {
+        uint8_t* types;
+        int gen;
+    };
+
+    FILE* out;
+    int height;  // Interior rows
+    int width;   // Interior columns
+    int slots;
+
+    Arena arena;
+    Slot* ring;
+    uint8_t* encoded;  // Writer thread's compression buffer
+
+    std::mutex mut;
+    std::condition_variable filled;
+    std::condition_variable freed;
+    int head;      // Next slot to hand out
+    int tail;      // Next slot to write
+    int inflight;  // Acquired and not yet written
+    bool stopping;
+    bool writeFailed;  // Only touched by the writer thread until it is joined
+
+    std::thread worker;
+
+    SnapshotWriter() = delete;
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter(FILE* out, int h, int w, int slots);
+    ~SnapshotWriter();
+
+    static size_t bytes(int h, int w, int slots);
+
+    bool ok() const { return arena.ok(); }
+    bool failed() const { return writeFailed; }
+
+    Slot& acquire();
+    void publish(Slot& slot, int gen);
+    void copyRows(Slot& slot, const Matrix<Entity>& map, int first, int last) const;
+    void capture(const Matrix<Entity>& map, int gen);
+    void finish();
+
+    void loop();
+    size_t encode(const uint8_t* types) const;
+    bool write(int gen, size_t n);
+};
+
+inline size_t SnapshotWriter::bytes(int h, int w, int slots) {
+    const size_t cells = static_cast<size_t>(h) * w;
+    return Arena::align(slots * sizeof(Slot)) + slots * Arena::align(cells) +
+           Arena::align(2 * cells);
+}
+
+inline SnapshotWriter::SnapshotWriter(FILE* out, int h, int w, int slots)
+    : out(out),
+      height(h),
+      width(w),
+      slots(slots),
+      arena(bytes(h, w, slots)),
+      ring(arena.allocate<Slot>(slots)),
+      encoded(arena.allocate<uint8_t>(2 * static_cast<size_t>(h) * w)),
+      head(0),
+      tail(0),
+      inflight(0),
+      stopping(false),
+      writeFailed(false) {
+    if (!arena.ok())
+        return;
+    for (int i = 0; i < slots; ++i) {
+        ring[i].gen = -1;
+        ring[i].types = arena.allocate<uint8_t>(static_cast<size_t>(h) * w);
+    }
+    worker = std::thread(&SnapshotWriter::loop, this);
+}
+
+inline SnapshotWriter::~SnapshotWriter() {
+    finish();
+}
+
+/**
+ * Hands out the next free slot, waiting for the writer if none is
+ */
+inline SnapshotWriter::Slot& SnapshotWriter::acquire() {
+    std::unique_lock<std::mutex> lk{mut};
+    freed.wait(lk, [this] { return inflight < slots; });
+    ++inflight;
+    Slot& slot = ring[head];
+    head = (head + 1) % slots;
+    slot.gen = -1;
+    return slot;
+}
+
+// Copies matrix rows [first, last) of map into the slot
+inline void SnapshotWriter::copyRows(Slot& slot, const Matrix<Entity>& map,
+                                     int first, int last) const {
+    for (int i = first; i < last; ++i) {
+        uint8_t* dst = slot.types + static_cast<size_t>(i - 1) * width;
+        const Entity* src = &map(i, 1);
+        for (int j = 0; j < width; ++j)
+            dst[j] = src[j].type;
+    }
+}
+
+inline void SnapshotWriter::publish(Slot& slot, int gen) {
+    {
+        std::lock_guard<std::mutex> lk{mut};
+        slot.gen = gen;
+    }
+    filled.notify_one();
+}
+
+// Acquire, copy and publish from a single thread
+inline void SnapshotWriter::capture(const Matrix<Entity>& map, int gen) {
+    Slot& slot = acquire();
+    copyRows(slot, map, 1, height + 1);
+    publish(slot, gen);
+}
+
+/**
+ * Waits for every published frame to be written and stops the writer
+ */
+inline void SnapshotWriter::finish() {
+    if (!worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk{mut};
+        stopping = true;
+    }
+    filled.notify_one();
+    worker.join();
+    if (fflush(out) != 0)
+        writeFailed = true;
+}
+
+inline void SnapshotWriter::loop() {
+    std::unique_lock<std::mutex> lk{mut};
+    for (;;) {
+        // Slots are published in the order they were acquired
+        filled.wait(lk, [this] { return (inflight > 0 && ring[tail].gen >= 0) || stopping; });
+        if (!(inflight > 0 && ring[tail].gen >= 0))
+            break;
+
+        Slot& slot = ring[tail];
+        lk.unlock();
+
+        if (!writeFailed && !write(slot.gen, encode(slot.types)))
+            writeFailed = true;
+
+        lk.lock();
+        slot.gen = -1;
+        tail = (tail + 1) % slots;
+        --inflight;
+        freed.notify_one();
+    }
+}
+
+inline size_t SnapshotWriter::encode(const uint8_t* types) const {
+    const size_t cells = static_cast<size_t>(height) * width;
+    size_t n = 0;
+    for (size_t i = 0; i < cells;) {
+        size_t run = 1;
+        while (i + run < cells && types[i + run] == types[i])
+            ++run;
+        for (size_t r = run; ; r >>= 7) {
+            if (r < 0x80) {
+                encoded[n++] = static_cast<uint8_t>(r);
+                break;
+            }
+            encoded[n++] = static_cast<uint8_t>(r & 0x7f) | 0x80;
+        }
+        encoded[n++] = types[i];
+        i += run;
+    }
+    return n;
+}
+
+// Appends a frame whose payload is the first n bytes of encoded. The header
+// is laid out byte by byte, so the file is little endian whatever the host
+inline bool SnapshotWriter::write(int gen, size_t n) {
+    uint8_t header[24] = {'E', 'C', 'O', 'F'};
+    auto put = [&header](int at, uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; ++i)
+            header[at + i] = static_cast<uint8_t>(v >> (8 * i));
+    };
+    put(4, static_cast<uint32_t>(gen), 4);
+    put(8, static_cast<uint32_t>(height), 4);
+    put(12, static_cast<uint32_t>(width), 4);
+    put(16, n, 8);
+    return fwrite(header, 1, sizeof header, out) == sizeof header &&
+           fwrite(encoded, 1, n, out) == n;
+}
+
+} // namespace eco
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+
+#include "entity.hpp"
+
+/**
+ * species.hpp
+ *
+ * The species of the ecosystem and the rules each one follows, as
+ * compile-time traits.
+ *
+ * Ecosystem lists the species in the order they move within a generation.
+ * The engines loop over it and their update kernels are templates over the
+ * traits, so each species gets its own inlined kernel with the rules that
+ * don't apply to it folded away, and the species set lives in one place.
+ *
+ * Breeding and starvation ages are read from the input, so they sit in the
+ * World's SpeciesTable, indexed by Entity_t, and the traits only look them
+ * up. Adding a species means adding its Entity_t, a specialization here, its
+ * place in Ecosystem and its ages in the input. Everything else that depends
+ * on the species (fast-forwarding, the work estimate of balanced schedules)
+ * goes through Ecosystem.
+ */
+
+namespace eco {
+
+// Breeding and starvation ages of one species
+struct SpeciesParams {
+    int genProc;  // Generations until it can procreate
+    int genFood;  // Generations it can go without food, if it starves
+};
+
+using SpeciesTable = std::array<SpeciesParams, ENTITY_TYPES_N>;
+
+// What every species' traits share: its type and where its ages are kept
+template <Entity_t T>
+struct SpeciesBase {
+    static constexpr Entity_t type = T;
+
+    template <class W> static int genProc(const W& w) { return w.species[T].genProc; }
+    template <class W> static int genFood(const W& w) { return w.species[T].genFood; }
+};
+
+template <Entity_t T>
+struct Species;
+
+template <>
+struct Species<RABBIT> : SpeciesBase<RABBIT> {
+    static constexpr Entity_t prey    = EMPTY;  // Eats nothing, only moves onto empty cells
+    static constexpr bool starves     = false;  // Dies after genFood generations without eating
+    static constexpr bool tieOnHunger = false;  // Of two equally old, the less hungry wins a cell
+};
+
+template <>
+struct Species<FOX> : SpeciesBase<FOX> {
+    static constexpr Entity_t prey    = RABBIT;
+    static constexpr bool starves     = true;
+    static constexpr bool tieOnHunger = true;
+};
+
+using Rabbits = Species<RABBIT>;
+using Foxes   = Species<FOX>;
+
+// Passes a species to a generic lambda
+template <class S>
+struct SpeciesTag {
+    using type = S;
+};
+
+/**
+ * An ordered set of species. forEach calls f with a SpeciesTag of each in
+ * turn and contains says whether a cell's type is one of them
+ */
+template <class... S>
+struct SpeciesList;
+
+template <>
+struct SpeciesList<> {
+    static constexpr int size = 0;
+
+    static constexpr bool contains(Entity_t) { return false; }
+    template <class F> static void forEach(F&&) {}
+};
+
+template <class S, class... Rest>
+struct SpeciesList<S, Rest...> {
+    using Next = SpeciesList<Rest...>;
+
+    static constexpr int size = 1 + Next::size;
+
+    static constexpr bool contains(Entity_t t) { return t == S::type || Next::contains(t); }
+
+    template <class F>
+    static void forEach(F&& f) {
+        f(SpeciesTag<S>{});
+        Next::forEach(f);
+    }
+};
+
+using Ecosystem = SpeciesList<Rabbits, Foxes>;
+
+template <class S>
+constexpr bool hunts() {
+    return S::prey != EMPTY;
+}
+
+/**
+ * Whether a, moving into a cell, takes it from b, whatever was there so far.
+ * Only S moves during its phase, and only onto empty cells or its prey, so b
+ * is one of those or another S that got there first
+ */
+template <class S>
+inline bool winsCell(const Entity& a, const Entity& b) {
+    if (b.type != S::type)
+        return true;
+    return a.age > b.age || (S::tieOnHunger && a.age == b.age && a.hunger < b.hunger);
+}
+
+} // namespace eco
@@ -0,0 +1,87 @@
+/**
+ * count_region.c
+ *
+ * Checks eco_count_region against a plain scan of eco_grid, for random
+ * rectangles of worlds whose sides aren't multiples of the index's tiles,
+ * before and after stepping. Built from C against libecosystem.a by
+ * make tests; exits non-zero on the first mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../ecosystem.h"
+
+#define RECTANGLES 2000
+
+static uint32_t state = 12345;
+
+static int next(int n) {
+    state = state * 1103515245u + 12345u;
+    return (int)((state >> 8) % (uint32_t)n);
+}
+
+static int64_t scan(eco_grid_view g, int type, int r0, int c0, int r1, int c1) {
+    int64_t k = 0;
+    for (int i = r0 < 0 ? 0 : r0; i < r1 && i < g.height; ++i)
+        for (int j = c0 < 0 ? 0 : c0; j < c1 && j < g.width; ++j)
+            k += g.cells[(size_t)i * g.stride + j].type == type;
+    return k;
+}
+
+static int check(eco_world* world, const char* when) {
+    const eco_grid_view g = eco_grid(world);
+    for (int n = 0; n < RECTANGLES; ++n) {
+        /* A little past the edges too, which must be clamped */
+        const int r0 = next(g.height + 4) - 2, r1 = r0 + next(g.height + 4);
+        const int c0 = next(g.width + 4) - 2, c1 = c0 + next(g.width + 4);
+        for (int t = ECO_EMPTY; t < ECO_TYPES_N; ++t) {
+            const int64_t got = eco_count_region(world, (eco_type)t, r0, c0, r1, c1);
+            const int64_t want = scan(g, t, r0, c0, r1, c1);
+            if (got != want) {
+                fprintf(stderr, "%dx%d %s: %s in [%d, %d) x [%d, %d) is %lld, not %lld\n",
+                        g.height, g.width, when, eco_type_name((eco_type)t), r0, r1,
+                        c0, c1, (long long)got, (long long)want);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int run(int height, int width) {
+    const eco_params params = {4, 8, 6, height, width};
+    const size_t count = (size_t)height * width / 3;
+    eco_placement* placements = malloc(count * sizeof(eco_placement));
+    if (placements == NULL)
+        return 0;
+    for (size_t i = 0; i < count; ++i) {
+        const int roll = next(10);
+        placements[i].type = roll < 5 ? ECO_RABBIT : roll < 8 ? ECO_FOX : ECO_ROCK;
+        placements[i].row = next(height);
+        placements[i].col = next(width);
+    }
+
+    eco_world* world = eco_create(&params, placements, count);
+    free(placements);
+    if (world == NULL) {
+        fprintf(stderr, "%dx%d: eco_create failed\n", height, width);
+        return 0;
+    }
+
+    int ok = check(world, "as placed");
+    for (int step = 0; ok && step < 3; ++step) {
+        eco_step(world, 7);
+        ok = check(world, "stepped");
+    }
+    eco_destroy(world);
+    return ok;
+}
+
+int main(void) {
+    const int sizes[][2] = {{1, 1}, {5, 5}, {13, 37}, {64, 64}, {71, 29}, {150, 97}};
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; ++i)
+        if (!run(sizes[i][0], sizes[i][1]))
+            return 1;
+    return 0;
+}
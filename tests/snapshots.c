@@ -0,0 +1,73 @@
+/**
+ * snapshots.c
+ *
+ * Checks that snapshots started part way through a run are taken at the
+ * start generation and every `every` generations from it, by reading back
+ * the frame headers. Built from C against libecosystem.a by make tests;
+ * takes the path of the file to write and exits non-zero on a mismatch.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../ecosystem.h"
+
+#define START 5
+#define EVERY 4
+#define END   18
+
+static uint32_t readU32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2)
+        return 2;
+
+    const eco_params params = {3, 5, 4, 6, 7};
+    const eco_placement placements[] = {
+        {ECO_ROCK, 2, 3},   {ECO_RABBIT, 0, 0}, {ECO_RABBIT, 1, 5},
+        {ECO_RABBIT, 4, 2}, {ECO_RABBIT, 5, 6}, {ECO_FOX, 3, 0},
+        {ECO_FOX, 0, 4},
+    };
+    eco_world* world =
+        eco_create(&params, placements, sizeof placements / sizeof placements[0]);
+    if (world == NULL)
+        return 1;
+
+    eco_step(world, START);
+    if (eco_snapshots_start(world, argv[1], EVERY, 2) != 0) {
+        fprintf(stderr, "snapshots: can't write %s\n", argv[1]);
+        return 1;
+    }
+    eco_step(world, END - START);
+    const int stopped = eco_snapshots_stop(world);
+    eco_destroy(world);
+    if (stopped != 0)
+        return 1;
+
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL)
+        return 1;
+    int frames = 0;
+    unsigned char header[24];
+    while (fread(header, 1, sizeof header, in) == sizeof header) {
+        const int32_t gen = (int32_t)readU32(header + 4);
+        const uint64_t bytes = readU32(header + 16) | (uint64_t)readU32(header + 20) << 32;
+        if (memcmp(header, "ECOF", 4) != 0 || gen != START + frames * EVERY ||
+            fseek(in, (long)bytes, SEEK_CUR) != 0) {
+            fprintf(stderr, "snapshots: frame %d is not of generation %d\n", frames,
+                    START + frames * EVERY);
+            fclose(in);
+            return 1;
+        }
+        ++frames;
+    }
+    fclose(in);
+
+    if (frames != (END - START) / EVERY + 1) {
+        fprintf(stderr, "snapshots: %d frames, not %d\n", frames, (END - START) / EVERY + 1);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,613 @@
+#pragma once
+
+/**
+ * world_pull.hpp
+ *
+ * Resolves moves by gathering instead of scattering: every cell of the next
+ * grid is computed on its own, from the current grid alone.
+ *
+ * Moves are deterministic, so a cell can work out which of its four
+ * neighbours move into it. Incoming entities are resolved in the order the
+ * sequential engine visits them (north, west, east, south), which makes the
+ * result identical to world_sequential.hpp without any queues, locks or row
+ * ownership.
+ *
+ * Each update is divided in 4 steps:
+ *
+ *     1) Record in a direction grid where every rabbit of map goes
+ *
+ *     2) Compute every cell of nextMap from map and the direction grid:
+ *        A rabbit's own cell becomes the rabbit, a newborn or empty
+ *        An empty cell becomes the winner of the rabbits moving into it
+ *
+ *     3, 4) Repeat for foxes, computing map from nextMap
+ *
+ * Recording the directions first means each move is selected once rather
+ * than once per neighbour, and the gather itself is a handful of byte
+ * compares per cell. Since every interior cell is rewritten the grids simply
+ * trade places between phases and nothing is copied, unless Ecosystem has an
+ * odd number of species: then the generation ends up in nextMap and is
+ * copied back into map. Threads get a static block of rows each and the run
+ * happens inside a single parallel region, driven by parallel.hpp.
+ *
+ * Both steps go a row at a time through pointers read up front and pick
+ * moves from a table rather than dividing, which puts a single thread on par
+ * with the sequential engine. Where gathering pays off is with more threads:
+ * they share nothing but the barrier, where the queue engine hands moves
+ * across block edges and copies its rows back every phase.
+ *
+ * A world too big for memory can be kept in a file instead (streaming). Each
+ * step only looks one row past the rows it computes, so rather than a pass
+ * over the grid per step a generation is a single sweep of bands: step 1
+ * works on band k while step 2 works on band k - 1 and so on. Only the bands around
+ * the sweep need to be in memory; the next bands of map are read ahead, the
+ * finished ones written back, and rows of nextMap and the direction grid that
+ * nothing will read again are dropped instead of written.
+ */
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+#ifndef NTHREADS
+#define NTHREADS 4
+#endif
+
+#ifndef STREAM_BAND_BYTES
+#define STREAM_BAND_BYTES (4 << 20)
+#endif
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "barrier.hpp"
+#include "cycle.hpp"
+#include "debug.hpp"
+#include "density.hpp"
+#include "entity.hpp"
+#include "matrix.hpp"
+#include "omp.h"
+#include "parallel.hpp"
+#include "schedule.hpp"
+#include "snapshot.hpp"
+#include "species.hpp"
+
+namespace eco {
+
+struct World {
+    // What the entity in a cell does this phase
+    enum Move : uint8_t { STAY, GO_NORTH, GO_EAST, GO_SOUTH, GO_WEST, STARVE };
+
+    // Steps in a generation: finding and then applying moves, per species,
+    // and copying the generation back into map after an odd number of them
+    static constexpr int STAGES = 2 * Ecosystem::size + Ecosystem::size % 2;
+
+    // Rows [first, last) and columns [left, right) of the grid
+    struct Block {
+        int first, last;
+        int left, right;
+    };
+
+    // An entity's fields, kept apart while pull computes it
+    struct Cell {
+        int type, age, hunger;
+    };
+
+    // Rows i - 1, i and i + 1 of a grid and of the moves made from it
+    struct Rows {
+        const Entity* cells[3];
+        const uint8_t* moves[3];
+    };
+
+    SpeciesTable species;  // Breeding and starvation ages, by Entity_t
+
+    int current_gen;
+    int entity_count;
+    int height;
+    int width;
+
+    int max_threads;  // Per-thread buffers are reserved for this many threads
+    int nthreads;     // Threads used by run(), set through setSchedule
+    Schedule schedule;
+    int streamBand;   // Rows per band when streaming from a file, 0 otherwise
+
+    Arena arena;
+
+    Matrix<Entity> map;
+    Matrix<Entity> nextMap;
+    Matrix<uint8_t> moves;  // Move of each cell's entity, borders stay STAY
+
+    std::vector<int> firstRow;  // First row of each thread's block, plus one past the end
+    SpinBarrier barrier;
+
+    uint64_t hash;  // Zobrist hash of map while detecting
+    ThreadDelta* delta;
+    CycleDetector cycles;  // Empty when streaming, which never detects cycles
+
+    int64_t population[ENTITY_TYPES_N];  // Interior cells holding each type
+    DensityIndex density;
+
+    SnapshotWriter* snapshots;  // Receives a frame every snapshot_every generations, if set
+    int snapshot_every;
+    int snapshot_start;         // Generation of the first frame, which the others count from
+
+    World() = delete;
+    World(const SpeciesTable& params, int w, int h, int count,
+          int threads = defaultThreads(), const char* store = nullptr)
+        : species(params),
+          current_gen(0),
+          entity_count(count),
+          height(h + 1),
+          width(w + 1),
+          max_threads(std::max(threads, 1)),
+          nthreads(std::min(NTHREADS, max_threads)),
+          schedule(defaultSchedule(nthreads)),
+          streamBand(store != nullptr ? defaultStreamBand(w + 2) : 0),
+          arena(arenaBytes(h + 2, w + 2, max_threads, store != nullptr), store),
+          map(h + 2, w + 2, arena),
+          nextMap(h + 2, w + 2, arena),
+          moves(h + 2, w + 2, arena),
+          firstRow(std::vector<int>(max_threads + 1)),
+          barrier(nthreads),
+          hash(0),
+          delta(arena.allocate<ThreadDelta>(max_threads)),
+          cycles(store != nullptr ? 0 : h + 2, store != nullptr ? 0 : w + 2, arena),
+          population{static_cast<int64_t>(h) * w},
+          density(h, w, arena),
+          snapshots(nullptr),
+          snapshot_every(0),
+          snapshot_start(0) {}
+
+    static int defaultThreads() { return std::max(NTHREADS, omp_get_num_procs()); }
+    static int defaultStreamBand(int w) {
+        const int rows = static_cast<int>(STREAM_BAND_BYTES / (w * sizeof(Entity)));
+        return std::max(1, rows / DensityIndex::TILE) * DensityIndex::TILE;
+    }
+    static size_t arenaBytes(int h, int w, int threads, bool streaming = false) {
+        return 2 * Matrix<Entity>::bytes(h, w) + Matrix<uint8_t>::bytes(h, w) +
+               Arena::align(threads * sizeof(ThreadDelta)) +
+               (streaming ? 0 : CycleDetector::bytes(h, w)) +
+               DensityIndex::bytes(h - 2, w - 2);
+    }
+
+    void init();
+    void setSchedule(Schedule);
+    void partition(int);
+    void setStreamBand(int);
+    void run(int, bool = true);
+    void update();
+    template <bool TrackHash> inline void step(int, bool&);
+    template <bool TrackHash> inline void stepRows(int, bool&);
+    inline void sweep(int, bool&);
+    inline bool bandBlock(int, int, Block&) const;
+    inline void streamAdvise(int);
+    inline void copyBack(const Block&);
+    template <class S>
+    inline void findMoves(const Matrix<Entity>&, const Block&);
+    template <class S, bool TrackHash>
+    inline void updateSpecies(const Matrix<Entity>&, Matrix<Entity>&, const Block&, int);
+    template <class S>
+    inline Cell pull(const Rows&, int, int) const;
+
+    template <Entity_t Target>
+    static inline int neighbours(const Entity*, const Entity*, const Entity*, int);
+
+    inline void add(const std::string, const int, const int);
+    inline void add(const Entity_t, const int, const int);
+    inline void add(const Entity&, const int, const int);
+
+    int countEntities() const;
+    inline int64_t countRegion(Entity_t, int, int, int, int);
+
+    void print() const;
+    void printText() const;
+};
+
+/**
+ * The moves the sequential engine's selectDirection makes, as a table. For
+ * every value of x + y - 2 + current_gen modulo CHOICES and every set of
+ * neighbours holding what the entity looks for (a bit each for north, east,
+ * south and west), the move onto the neighbour it picks, STAY if there are
+ * none. CHOICES is a multiple of every possible number of neighbours, so the
+ * modulo picks the same one as selectDirection's
+ */
+struct MoveTable {
+    static constexpr int CHOICES = 12;
+
+    uint8_t move[CHOICES][16];
+};
+
+constexpr MoveTable makeMoveTable() {
+    MoveTable t{};
+    for (int k = 0; k < MoveTable::CHOICES; ++k) {
+        for (int set = 1; set < 16; ++set) {
+            uint8_t arr[4] = {};
+            int dirs = 0;
+            for (int dir = 0; dir < 4; ++dir)
+                if (set >> dir & 1)
+                    arr[dirs++] = World::GO_NORTH + dir;
+            t.move[k][set] = arr[k % dirs];
+        }
+    }
+    return t;
+}
+
+constexpr MoveTable MOVE_TABLE = makeMoveTable();
+
+void World::init() {
+    // nextMap's side borders are written along with each of its rows
+    const Entity ent = makeEntity(ROCK);
+    for (int i = 0; i != height + 1; ++i) {
+        map(i, 0)     = ent;
+        map(i, width) = ent;
+    }
+    for (int j = 0; j != width + 1; ++j) {
+        map(0, j)      = nextMap(0, j)      = ent;
+        map(height, j) = nextMap(height, j) = ent;
+    }
+
+    setSchedule(schedule);
+}
+
+void World::setSchedule(Schedule s) {
+    setRowSchedule(*this, s);
+}
+
+void World::partition(int threads) {
+    splitRows(*this, threads);
+}
+
+/**
+ * Rows per band of a streaming world, rounded to whole density tiles so each
+ * tile is only ever updated by one thread
+ */
+void World::setStreamBand(int rows) {
+    if (streamBand > 0)
+        streamBand = std::max(1, rows / DensityIndex::TILE) * DensityIndex::TILE;
+}
+
+/**
+ * Advances the world n generations, fast-forwarding once the state repeats or
+ * freezes unless told not to. A streaming world is too big to hash or keep a
+ * copy of, so it never does
+ */
+void World::run(int n, bool fastForward) {
+    runParallel(*this, n, fastForward && streamBand == 0);
+}
+
+/**
+ * One generation without setting up cycle detection, which costs a pass over
+ * the grid and a copy of it
+ */
+void World::update() {
+    run(1, false);
+}
+
+template <bool TrackHash>
+inline void World::step(int th, bool& sense) {
+    if (streamBand > 0)
+        sweep(th, sense);
+    else
+        stepRows<TrackHash>(th, sense);
+}
+
+/**
+ * One generation of an in-memory world, each thread computing its own rows
+ */
+template <bool TrackHash>
+inline void World::stepRows(int th, bool& sense) {
+    const Block rows{firstRow[th], firstRow[th + 1], 1, width};
+    int i = 0;
+    Ecosystem::forEach([&](auto species) {
+        using S = typename decltype(species)::type;
+        Matrix<Entity>& src = i % 2 == 0 ? map : nextMap;
+        Matrix<Entity>& dst = i % 2 == 0 ? nextMap : map;
+        findMoves<S>(src, rows);
+        barrier.wait(sense);
+        updateSpecies<S, TrackHash>(src, dst, rows, th);
+        barrier.wait(sense);
+        ++i;
+    });
+    if (Ecosystem::size % 2 == 1) {
+        copyBack(rows);
+        barrier.wait(sense);
+    }
+}
+
+/**
+ * One generation of a streaming world as a single sweep of bands, with step
+ * s of the STAGES (two per species) working on band k - s. A step reads one
+ * row into the bands on either side of its own, which the steps before it
+ * have already finished and the steps after it haven't started overwriting.
+ * With an odd number of species the last step copies band k - STAGES + 1 back
+ * into map. The last step's writes to map don't overlap anything the next
+ * round's first step touches, so it needs no barrier of its own
+ */
+inline void World::sweep(int th, bool& sense) {
+    const int bands   = (height - 1 + streamBand - 1) / streamBand;
+    const bool advise = th == 0 && !arena.fitsInMemory();
+    Block b;
+
+    for (int k = 0; k < bands + STAGES - 1; ++k) {
+        int s = 0;
+        Ecosystem::forEach([&](auto species) {
+            using S = typename decltype(species)::type;
+            Matrix<Entity>& src = s % 4 == 0 ? map : nextMap;
+            Matrix<Entity>& dst = s % 4 == 0 ? nextMap : map;
+            if (s > 0)
+                barrier.wait(sense);
+            if (bandBlock(k - s, th, b))
+                findMoves<S>(src, b);
+            barrier.wait(sense);
+            if (bandBlock(k - s - 1, th, b))
+                updateSpecies<S, false>(src, dst, b, th);
+            s += 2;
+        });
+        if (Ecosystem::size % 2 == 1) {
+            barrier.wait(sense);
+            if (bandBlock(k - STAGES + 1, th, b))
+                copyBack(b);
+        }
+        if (advise)
+            streamAdvise(k);
+    }
+    barrier.wait(sense);
+
+    if (advise) {
+        streamAdvise(bands + STAGES - 1);
+        streamAdvise(bands + STAGES);
+        // The next generation starts over from the top
+        streamAdvise(-2);
+        streamAdvise(-1);
+    }
+}
+
+/**
+ * Copies block b of nextMap into map. Species take turns computing one grid
+ * from the other, so after an odd number of them that is where the
+ * generation ends up
+ */
+inline void World::copyBack(const Block& b) {
+    for (int i = b.first; i < b.last; ++i)
+        std::copy(&nextMap(i, b.left), &nextMap(i, b.right), &map(i, b.left));
+}
+
+/**
+ * Thread th's share of band b. Bands are only a few rows tall, so they are
+ * split by columns, in whole density tiles. False if there is no share
+ */
+inline bool World::bandBlock(int b, int th, Block& block) const {
+    const int r0 = 1 + b * streamBand;
+    if (b < 0 || r0 >= height)
+        return false;
+    const int tiles = (width - 1 + DensityIndex::TILE - 1) / DensityIndex::TILE;
+    block.first = r0;
+    block.last  = std::min(r0 + streamBand, height);
+    block.left  = std::min(1 + tiles * th / nthreads * DensityIndex::TILE, width);
+    block.right = std::min(1 + tiles * (th + 1) / nthreads * DensityIndex::TILE, width);
+    return block.left < block.right;
+}
+
+/**
+ * Called once the sweep has handed out band k of the first step: reads map
+ * two bands ahead of it, writes back the band of map the last step finished a
+ * round ago and drops the scratch rows of the band before that. Only worth
+ * it when the store doesn't fit in memory, otherwise the page cache is better
+ * left to batch the writes
+ */
+inline void World::streamAdvise(int k) {
+    const size_t row = map.width * sizeof(Entity);
+    const int rows   = height - 1;
+    auto band = [&](int b, int& r0, int& n) {
+        r0 = 1 + b * streamBand;
+        n  = std::min(streamBand, rows - b * streamBand);
+        return b >= 0 && n > 0;
+    };
+
+    int r0, n;
+    if (band(k + 2, r0, n))
+        arena.prefetch(&map(r0, 0), n * row);
+    if (band(k - STAGES, r0, n))
+        arena.writeback(&map(r0, 0), n * row);
+    if (band(k - STAGES - 1, r0, n)) {
+        arena.discard(&nextMap(r0, 0), n * row);
+        arena.discard(&moves(r0, 0), static_cast<size_t>(n) * moves.width);
+    }
+}
+
+/**
+ * Records where every entity of species S in src goes: onto adjacent prey if
+ * it hunts and there is some, otherwise onto an adjacent empty cell, unless
+ * it starves first.
+ *
+ * The neighbours are looked up in MOVE_TABLE, with the position that
+ * selectDirection takes modulo kept as a counter along the row, rather than
+ * branching on each of them and dividing
+ */
+template <class S>
+void World::findMoves(const Matrix<Entity>& src, const Block& b) {
+    const int food  = S::genFood(*this);
+    const int right = b.right;
+    for (int i = b.first; i < b.last; ++i) {
+        // Writing the moves could alias anything as far as the compiler
+        // knows, so nothing is read through this or b inside the row
+        const Entity* above = &src(i - 1, 0);
+        const Entity* row   = &src(i, 0);
+        const Entity* below = &src(i + 1, 0);
+        uint8_t* out = &moves(i, 0);
+        int k = static_cast<int>((int64_t{i} + b.left - 2 + current_gen) % MoveTable::CHOICES);
+        for (int j = b.left; j < right; ++j) {
+            const Entity& ent = row[j];
+            uint8_t m = STAY;
+            if (ent.type == S::type) {
+                if (hunts<S>())
+                    m = MOVE_TABLE.move[k][neighbours<S::prey>(above, row, below, j)];
+                if (m == STAY && S::starves && ent.hunger + 1 >= food)
+                    m = STARVE;
+                else if (m == STAY)
+                    m = MOVE_TABLE.move[k][neighbours<EMPTY>(above, row, below, j)];
+            }
+            out[j] = m;
+            k = k == MoveTable::CHOICES - 1 ? 0 : k + 1;
+        }
+    }
+}
+
+/**
+ * Computes block b of dst from src once species S has moved. dst's side
+ * borders next to the block are rewritten too, since a streaming world drops
+ * its scratch rows and they come back zeroed
+ */
+template <class S, bool TrackHash>
+void World::updateSpecies(const Matrix<Entity>& src, Matrix<Entity>& dst,
+                          const Block& b, int th) {
+    const Entity rock = makeEntity(ROCK);
+    const int genProc = S::genProc(*this);
+    const int right   = b.right;
+    ThreadDelta& d    = delta[th];
+    for (int i = b.first; i < b.last; ++i) {
+        if (b.left == 1)
+            dst(i, 0) = rock;
+        if (b.right == width)
+            dst(i, width) = rock;
+        // As in findMoves, everything the row needs is read up front
+        const Rows rows{&src(i - 1, 0), &src(i, 0),   &src(i + 1, 0),
+                        &moves(i - 1, 0), &moves(i, 0), &moves(i + 1, 0)};
+        const size_t first = static_cast<size_t>(i) * src.width;
+        Entity* out = &dst(i, 0);
+        for (int j = b.left; j < right; ++j) {
+            const Entity cur = rows.cells[1][j];
+            const Cell c     = pull<S>(rows, j, genProc);
+            const Entity next{static_cast<Entity_t>(c.type), static_cast<short>(c.age),
+                              static_cast<short>(c.hunger)};
+            if (TrackHash && !sameEntity(cur, next))
+                d.hash ^= cellKey(first + j, cur) ^ cellKey(first + j, next);
+            if (cur.type != next.type) {
+                --d.population[cur.type];
+                ++d.population[next.type];
+                density.change(i, j, cur.type, next.type);
+            }
+            out[j] = next;
+        }
+    }
+}
+
+/**
+ * What cell j of rows holds once species S, which breeds at genProc, has
+ * moved. The result is kept as a Cell of plain ints: assembled as an Entity
+ * field by field, GCC builds it on the stack and reads it back as a whole,
+ * which stalls on every cell
+ */
+template <class S>
+inline World::Cell World::pull(const Rows& rows, int j, int genProc) const {
+    const Entity& cur = rows.cells[1][j];
+
+    // If cur is of species S it stays a generation older, or leaves behind a
+    // newborn or nothing. Worked out with selects, since which is anyone's
+    // guess
+    const uint8_t m   = rows.moves[1][j];
+    const short age   = static_cast<short>(cur.age + 1);
+    const bool stays  = m == STAY;
+    const bool born   = !stays && !(S::starves && m == STARVE) && age > genProc;
+    const Cell mine{stays || born ? S::type : EMPTY, stays ? age : 0,
+                    stays ? static_cast<short>(cur.hunger + S::starves) : 0};
+    if (cur.type == S::type)
+        return mine;
+
+    // Neighbours moving in, in the order the sequential engine visits them,
+    // one branch for the usual case of none
+    const int in = (rows.moves[0][j] == GO_SOUTH) | (rows.moves[1][j - 1] == GO_EAST) << 1 |
+                   (rows.moves[1][j + 1] == GO_WEST) << 2 | (rows.moves[2][j] == GO_NORTH) << 3;
+    if (in == 0)
+        return {cur.type, cur.age, cur.hunger};
+
+    // Hunters only move onto their prey when they eat it
+    const bool ate = hunts<S>() && cur.type == S::prey;
+    Cell best{cur.type, cur.age, cur.hunger};
+    // The same test as winsCell
+    auto offer = [&](const Entity& from) {
+        const short grown  = static_cast<short>(from.age + 1);
+        const short age    = grown > genProc ? 0 : grown;
+        const short hunger = !S::starves ? from.hunger : ate ? 0 : static_cast<short>(from.hunger + 1);
+        if (best.type != S::type || age > best.age ||
+            (S::tieOnHunger && age == best.age && hunger < best.hunger))
+            best = {S::type, age, hunger};
+    };
+    if (in & 1) offer(rows.cells[0][j]);
+    if (in & 2) offer(rows.cells[1][j - 1]);
+    if (in & 4) offer(rows.cells[1][j + 1]);
+    if (in & 8) offer(rows.cells[2][j]);
+    return best;
+}
+
+inline void World::add(const std::string e, const int x, const int y) {
+    add(makeEntity(e).type, x, y);
+}
+
+inline void World::add(const Entity_t t, const int x, const int y) {
+    add(makeEntity(t), x, y);
+}
+
+inline void World::add(const Entity& e, const int x, const int y) {
+    --population[map(x + 1, y + 1).type];
+    ++population[e.type];
+    density.change(x + 1, y + 1, map(x + 1, y + 1).type, e.type);
+    map(x + 1, y + 1) = nextMap(x + 1, y + 1) = e;
+}
+
+/**
+ * Which neighbours of cell j of row hold Target, as a set for MOVE_TABLE
+ */
+template <Entity_t Target>
+inline int World::neighbours(const Entity* above, const Entity* row,
+                             const Entity* below, int j) {
+    return (above[j].type == Target) | (row[j + 1].type == Target) << 1 |
+           (below[j].type == Target) << 2 | (row[j - 1].type == Target) << 3;
+}
+
+int World::countEntities() const {
+    int k = 0;
+    for (int i = 1; i != height; ++i) {
+        for (int j = 1; j != width; ++j) {
+            auto ent = map(i, j).type;
+            if (ent != Entity_t::EMPTY) k++;
+        }
+    }
+    return k;
+}
+
+/**
+ * Number of entities of type t in rows [r0, r1) and columns [c0, c1)
+ */
+inline int64_t World::countRegion(Entity_t t, int r0, int c0, int r1, int c1) {
+    return density.count(t, r0, c0, r1, c1);
+}
+
+void World::print() const {
+    for (int i = 0; i < width + 1; ++i) std::cout << "-";
+    std::cout << '\n';
+    for (int i = 1; i < height; ++i) {
+        std::cout << '|';
+        for (int j = 1; j < width; ++j) {
+            printEntity(map(i, j).type);
+        }
+        std::cout << "|\n";
+    }
+    for (int i = 0; i < width + 1; ++i) std::cout << "-";
+    std::cout << '\n';
+}
+
+void World::printText() const {
+    for (int i = 1; i < height; ++i) {
+        for (int j = 1; j < width; ++j) {
+            if (map(i, j).type != EMPTY)
+                std::cout << entityName(map(i, j).type) << ' ' << i - 1 << ' '
+                          << j - 1 << '\n';
+        }
+    }
+}
+
+} // namespace eco
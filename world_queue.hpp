@@ -8,18 +8,26 @@
  *
  * Moves are stored in an temporary grid to prevent moves affecting future
  * computations.
+ *
+ * Each thread owns a contiguous block of rows and the whole run happens inside
+ * a single parallel region, driven by parallel.hpp.
  * 
- * Each update is divided in 6 steps:
+ * Each update is divided in 4 steps:
+ *
+ *     1) Iterate the rabbits in the thread's rows and find their moves:
+ *        If the rabbit stays in rows owned by the thread, update it instantly
+ *        If it moves into another thread's rows, push the move into that thread's queue
  *
- *     1) Iterate rabbits and find their moves:
- *        If the rabbit stays in the same row, update it instantly
- *        If it moves to a different row, push the move into that row's queue
+ *     2) Apply any attempts to move in the thread's queues, resolving conflicts, then
+ *        copy the thread's rows of the temporary map into the map
  *
- *     2) Iterate through each row and apply any attemps to move in its queue. Conflict resolution is applied in this step.
- *     
- *     3) Replace the map with the temporary map
+ *     3, 4) Repeat for foxes
  *
- *     4, 5, 6) Repeat for foxes
+ * Only moves out of the first and last row of a block can cross into another
+ * thread's rows. Each thread has one queue for moves coming from the block
+ * above and one for the block below, so every queue has a single producer and
+ * holds at most width moves. All buffers are reserved from the World's arena
+ * at construction.
  */
 
 #ifndef DEBUG
@@ -30,15 +38,27 @@
 #define NTHREADS 4
 #endif
 
+#include <algorithm>
+#include <new>
 #include <string>
 #include <vector>
 #include <tuple>
 
+#include "arena.hpp"
+#include "barrier.hpp"
 #include "concurrentvector.hpp"
+#include "cycle.hpp"
 #include "debug.hpp"
+#include "density.hpp"
 #include "entity.hpp"
 #include "matrix.hpp"
 #include "omp.h"
+#include "parallel.hpp"
+#include "schedule.hpp"
+#include "snapshot.hpp"
+#include "species.hpp"
+
+namespace eco {
 
 enum Direction { NORTH, EAST, SOUTH, WEST, INPLACE };
 
@@ -51,60 +71,109 @@ struct World {
         Entity next;
     };
 
-    int GEN_PROC_RABBITS;  // Number of generations until a rabbit can procrate
-    int GEN_PROC_FOXES;    // As above but for foxes
-    int GEN_FOOD_FOXES;    // How many generations a fox can go without food
-    int N_GEN;             // How many generations the world will last
+    SpeciesTable species;  // Breeding and starvation ages, by Entity_t
 
     int current_gen;
     int entity_count;
     int height;
     int width;
+
+    int max_threads;  // Per-thread buffers are reserved for this many threads
+    int nthreads;     // Threads used by run(), set through setSchedule
+    Schedule schedule;
+
+    Arena arena;
     
     Matrix<Entity> map;
     Matrix<Entity> nextMap;
 
-    std::vector<int> owner;
-    std::vector<ConcurrentVector<Move>> sync;
+    int* owner;                  // Which thread owns each row
+    std::vector<int> firstRow;   // First row of each thread's block, plus one past the end
+    ConcurrentVector<Move>* sync;  // sync[2 * th] from above, sync[2 * th + 1] from below
+    SpinBarrier barrier;
+
+    uint64_t hash;  // Zobrist hash of nextMap while detecting, equal to map's between phases
+    ThreadDelta* delta;
+    CycleDetector cycles;
+
+    int64_t population[ENTITY_TYPES_N];  // Interior cells holding each type
+    DensityIndex density;
+
+    SnapshotWriter* snapshots;  // Receives a frame every snapshot_every generations, if set
+    int snapshot_every;
+    int snapshot_start;         // Generation of the first frame, which the others count from
 
     World() = delete;
-    World(int gen_proc_rabbits, int gen_proc_foxes, int gen_food_foxes,
-          int n_gen, int w, int h, int count)
-        : GEN_PROC_RABBITS(gen_proc_rabbits),
-          GEN_PROC_FOXES(gen_proc_foxes),
-          GEN_FOOD_FOXES(gen_food_foxes),
-          N_GEN(n_gen),
+    World(const SpeciesTable& params, int w, int h, int count,
+          int threads = defaultThreads())
+        : species(params),
           current_gen(0),
           entity_count(count),
           height(h + 1),
           width(w + 1),
-          map(Matrix<Entity>(h + 2, w + 2)),
-          nextMap(Matrix<Entity>(h + 2, w + 2)),
-          owner(std::vector<int>(height)),
-          sync(NTHREADS) {}
+          max_threads(std::max(threads, 1)),
+          nthreads(std::min(NTHREADS, max_threads)),
+          schedule(defaultSchedule(nthreads)),
+          arena(arenaBytes(h + 2, w + 2, max_threads)),
+          map(h + 2, w + 2, arena),
+          nextMap(h + 2, w + 2, arena),
+          owner(arena.allocate<int>(height)),
+          firstRow(std::vector<int>(max_threads + 1)),
+          sync(arena.allocate<ConcurrentVector<Move>>(2 * max_threads)),
+          barrier(nthreads),
+          hash(0),
+          delta(arena.allocate<ThreadDelta>(max_threads)),
+          cycles(h + 2, w + 2, arena),
+          population{static_cast<int64_t>(h) * w},
+          density(h, w, arena),
+          snapshots(nullptr),
+          snapshot_every(0),
+          snapshot_start(0) {
+        if (!arena.ok())
+            return;
+        for (int q = 0; q < 2 * max_threads; ++q) {
+            new (&sync[q]) ConcurrentVector<Move>();
+            sync[q].reserve(arena, queueCapacity(w + 2));
+        }
+    }
+
+    static int queueCapacity(int w) { return w; }
+    static int defaultThreads() { return std::max(NTHREADS, omp_get_num_procs()); }
+    static size_t arenaBytes(int h, int w, int threads) {
+        return 2 * Matrix<Entity>::bytes(h, w) +
+               Arena::align(h * sizeof(int)) +
+               Arena::align(2 * threads * sizeof(ConcurrentVector<Move>)) +
+               2 * threads * ConcurrentVector<Move>::bytes(queueCapacity(w)) +
+               Arena::align(threads * sizeof(ThreadDelta)) +
+               CycleDetector::bytes(h, w) +
+               DensityIndex::bytes(h - 2, w - 2);
+    }
 
     void init();
+    void setSchedule(Schedule);
+    void partition(int);
+    void run(int, bool = true);
     void update();
-    inline void updateRabbits();
-    inline void updateFoxes();
-    void updateRabbit(Entity, int, int);
-    void updateFox(Entity, int, int);
-    inline void clearQueues();
+    template <bool TrackHash> inline void step(int, bool&);
+    template <class S, bool TrackHash> inline void updateSpecies(int);
+    template <class S, bool TrackHash> inline void applyMoves(int);
+    template <class S, bool TrackHash> inline void updateAnimal(Entity, int, int, int);
+    inline void pushMove(int, int, int, const Entity&);
+    template <bool TrackHash> inline void put(int, int, const Entity&, int);
 
     inline int selectDirection(int, int, int) const;
     inline void updateCoords(Direction, int&, int&) const;
-    inline bool getRabbitMove(int&, int&) const;
-    inline bool getFoxMove(int&, int&) const;
-
-    inline bool resolveConflictRabbit(const Entity&, const Entity) const;
-    inline bool resolveConflictFox(const Entity&, const Entity) const;
+    template <Entity_t Target> inline bool getMove(int&, int&) const;
 
     inline void add(const std::string, const int, const int);
+    inline void add(const Entity_t, const int, const int);
+    inline void add(const Entity&, const int, const int);
 
     inline bool canMove(const Entity&, const Entity&) const;
     inline bool hasStarved(const Entity&) const;
 
     int countEntities() const;
+    inline int64_t countRegion(Entity_t, int, int, int, int);
 
     void print() const;
     void printText() const;
@@ -115,190 +184,166 @@ void World::init() {
     for (int i = 0; i != height + 1; ++i) {
         map(i, 0)      = nextMap(i, 0)      = ent;
         map(i, width)  = nextMap(i, width)  = ent;
-        map(0, i)      = nextMap(0, i)      = ent;
-        map(height, i) = nextMap(height, i) = ent;
     }
-
-    #pragma omp parallel for num_threads(NTHREADS)
-    for(int i = 1; i < height; ++i) {
-        owner[i] = omp_get_thread_num();
+    for (int j = 0; j != width + 1; ++j) {
+        map(0, j)      = nextMap(0, j)      = ent;
+        map(height, j) = nextMap(height, j) = ent;
     }
-}
 
-inline void World::clearQueues() {
-    for (int th = 0; th < NTHREADS; ++th) 
-        sync[th].clear();
+    setSchedule(schedule);
 }
 
-void World::update() {
-    #pragma omp parallel num_threads(NTHREADS)
-    {
-        #pragma omp for
-        for (int i = 1; i < height; ++i)
-            for (int j = 1; j < width; ++j)
-                if (map(i, j).type == RABBIT)
-                    updateRabbit(map(i, j), i, j);
-
-        #pragma omp barrier
-
-        #pragma omp for
-        for (int th = 0; th < NTHREADS; ++th) {
-            for (int i = 0; i < sync[th].size(); ++i) {
-                auto m = sync[th][i];
-                if (resolveConflictRabbit(m.next, nextMap(m.x, m.y)))
-                    nextMap(m.x, m.y) = m.next;
-            }
-        }
-
-        #pragma omp master
-        {
-        map = nextMap;
-        clearQueues();
-        }
-
-        #pragma omp barrier
+void World::setSchedule(Schedule s) {
+    setRowSchedule(*this, s);
+}
 
-        #pragma omp for
-        for (int i = 1; i < height; ++i)
-            for (int j = 1; j < width; ++j)
-                if (map(i, j).type == FOX)
-                    updateFox(map(i, j), i, j);
+void World::partition(int threads) {
+    splitRows(*this, threads);
 
-        #pragma omp barrier
+    for (int th = 0; th < nthreads; ++th)
+        for (int i = firstRow[th]; i < firstRow[th + 1]; ++i)
+            owner[i] = th;
+}
 
-        #pragma omp for
-        for (int th = 0; th < NTHREADS; ++th) {
-            for (int i = 0; i < sync[th].size(); ++i) {
-            auto m = sync[th][i];
-            if (resolveConflictFox(m.next, nextMap(m.x, m.y)))
-                nextMap(m.x, m.y) = m.next;
-            }
-        }
+/**
+ * Advances the world n generations, fast-forwarding once the state repeats or
+ * freezes unless told not to
+ */
+void World::run(int n, bool fastForward) {
+    runParallel(*this, n, fastForward);
+}
 
-        #pragma omp master
-        {
-            clearQueues();
-            map = nextMap;
-            current_gen++;
-        }
-    }
+/**
+ * One generation without setting up cycle detection, which costs a pass over
+ * the grid and a copy of it
+ */
+void World::update() {
+    run(1, false);
 }
 
-void World::updateRabbits() {
-    #pragma omp parallel for num_threads(NTHREADS)
-    for (int i = 1; i < height; ++i)
-        for (int j = 1; j < width; ++j)
-            if (map(i, j).type == RABBIT)
-                updateRabbit(map(i, j), i, j);
+template <bool TrackHash>
+inline void World::step(int th, bool& sense) {
+    Ecosystem::forEach([&](auto species) {
+        using S = typename decltype(species)::type;
+        updateSpecies<S, TrackHash>(th);
+        barrier.wait(sense);
+        applyMoves<S, TrackHash>(th);
+        barrier.wait(sense);
+    });
 }
 
-void World::updateFoxes() {
-    #pragma omp parallel for num_threads(NTHREADS)
-    for (int i = 1; i < height; ++i)
+template <class S, bool TrackHash>
+void World::updateSpecies(int th) {
+    for (int i = firstRow[th]; i < firstRow[th + 1]; ++i)
         for (int j = 1; j < width; ++j)
-            if (map(i, j).type == FOX)
-                updateFox(map(i, j), i, j);
+            if (map(i, j).type == S::type)
+                updateAnimal<S, TrackHash>(map(i, j), i, j, th);
 }
 
-void World::updateRabbit(Entity ent, int x, int y) {
-    dbg::LOGLN("\nRabbit (%d,%d)", x, y);
-    int oldX = x, oldY = y;
-
-    ++ent.age;
-    dbg::LOGLN("Age: %d", ent.age);
-
-    if (getRabbitMove(x, y) == false) {
-        dbg::LOGLN("Staying still");
-        nextMap(oldX, oldY) = ent;
-        return;
+template <class S, bool TrackHash>
+void World::applyMoves(int th) {
+    for (int q = 2 * th; q < 2 * th + 2; ++q) {
+        for (int i = 0; i < sync[q].size(); ++i) {
+            auto m = sync[q][i];
+            if (winsCell<S>(m.next, nextMap(m.x, m.y)))
+                put<TrackHash>(m.x, m.y, m.next, th);
+        }
+        sync[q].clear();
     }
+    map.copyRows(nextMap, firstRow[th], firstRow[th + 1]);
+}
 
-    dbg::LOGLN("Moving to (%d,%d)", x, y);
-
-    if (ent.age > GEN_PROC_RABBITS) {
-        ent.age = 0;
-        nextMap(oldX, oldY) = {RABBIT};
-    } else {
-        nextMap(oldX, oldY) = {EMPTY};
-    }
-    
-    int th = omp_get_thread_num();
-    if (th == owner[x]) {
-        if (resolveConflictRabbit(ent, nextMap(x, y)))
-            nextMap(x, y) = ent;
-    } else
-        sync[th].push_back({x, y, ent});
+inline void World::pushMove(int oldX, int x, int y, const Entity& ent) {
+    const int dest = owner[x];
+    sync[2 * dest + (x > oldX ? 0 : 1)].push_back({x, y, ent});
 }
 
-void World::updateFox(Entity ent, int x, int y) {
-    dbg::LOGLN("\nFox (%d,%d)", x, y);
+/**
+ * Hunters go for an adjacent prey first; failing that, or for everything
+ * else, an adjacent empty cell. Starvation is only checked when nothing was
+ * eaten
+ */
+template <class S, bool TrackHash>
+void World::updateAnimal(Entity ent, int x, int y, int th) {
+    dbg::LOGLN("\n%s (%d,%d)", ENTITY_NAME[S::type].c_str(), x, y);
     int oldX = x, oldY = y;
 
     ++ent.age;
     dbg::LOGLN("Age: %d", ent.age);
-    dbg::LOGLN("Hunger: %d", ent.hunger + 1);
 
-    if (getFoxMove(x, y) == true) {
-        dbg::LOGLN("Ate rabbit");
+    if (hunts<S>() && getMove<S::prey>(x, y)) {
+        dbg::LOGLN("Ate");
         ent.hunger = 0;
     } else {
-        ++ent.hunger;
-        if (ent.hunger >= GEN_FOOD_FOXES) {
+        if (S::starves && ++ent.hunger >= S::genFood(*this)) {
             dbg::LOGLN("Starved");
-            nextMap(oldX, oldY) = {EMPTY};
+            put<TrackHash>(oldX, oldY, {EMPTY}, th);
             return;
         }
-        if (getRabbitMove(x, y) == false) {
+        if (getMove<EMPTY>(x, y) == false) {
             dbg::LOGLN("Staying still");
-            nextMap(oldX, oldY) = ent;
+            put<TrackHash>(oldX, oldY, ent, th);
             return;
         }
     }
 
     dbg::LOGLN("Moving to (%d,%d)", x, y);
 
-    if (ent.age > GEN_PROC_FOXES) {
+    if (ent.age > S::genProc(*this)) {
         ent.age = 0;
-        nextMap(oldX, oldY) = {FOX};
+        put<TrackHash>(oldX, oldY, {S::type}, th);
     } else {
-        nextMap(oldX, oldY) = {EMPTY};
+        put<TrackHash>(oldX, oldY, {EMPTY}, th);
     }
 
-    int th = omp_get_thread_num();
     if (th == owner[x]) {
-        if (resolveConflictFox(ent, nextMap(x, y)))
-            nextMap(x, y) = ent;
+        if (winsCell<S>(ent, nextMap(x, y)))
+            put<TrackHash>(x, y, ent, th);
     } else {
-        sync[th].push_back({x, y, ent});
+        pushMove(oldX, x, y, ent);
+    }
+}
+
+template <bool TrackHash>
+inline void World::put(int x, int y, const Entity& e, int th) {
+    const size_t index = static_cast<size_t>(x) * nextMap.width + y;
+    const Entity_t old = nextMap.arr[index].type;
+    if (TrackHash)
+        delta[th].hash ^= cellKey(index, nextMap.arr[index]) ^ cellKey(index, e);
+    if (old != e.type) {
+        --delta[th].population[old];
+        ++delta[th].population[e.type];
+        density.change(x, y, old, e.type);
     }
+    nextMap.arr[index] = e;
 }
 
 inline void World::add(const std::string e, const int x, const int y) {
-    map(x + 1, y + 1) = nextMap(x + 1, y + 1) = makeEntity(e);
+    add(makeEntity(e).type, x, y);
 }
 
-inline bool World::getRabbitMove(int& x, int& y) const {
-    Direction arr[4];
-    int dirs = 0;
-    if (map(x - 1, y).type == EMPTY) arr[dirs++] = NORTH;
-    if (map(x, y + 1).type == EMPTY) arr[dirs++] = EAST;
-    if (map(x + 1, y).type == EMPTY) arr[dirs++] = SOUTH;
-    if (map(x, y - 1).type == EMPTY) arr[dirs++] = WEST;
-    if (dirs > 0) {
-        int rnd = selectDirection(x, y, dirs);
-        updateCoords(arr[rnd], x, y);
-        return true;
-    }
-    return false;
+inline void World::add(const Entity_t t, const int x, const int y) {
+    add(makeEntity(t), x, y);
 }
 
-inline bool World::getFoxMove(int& x, int& y) const {
+inline void World::add(const Entity& e, const int x, const int y) {
+    --population[map(x + 1, y + 1).type];
+    ++population[e.type];
+    density.change(x + 1, y + 1, map(x + 1, y + 1).type, e.type);
+    map(x + 1, y + 1) = nextMap(x + 1, y + 1) = e;
+}
+
+/**
+ * Moves (x, y) onto a neighbouring cell holding Target, if there is one
+ */
+template <Entity_t Target>
+inline bool World::getMove(int& x, int& y) const {
     Direction arr[4];
     int dirs = 0;
-    if (map(x - 1, y).type == RABBIT) arr[dirs++] = NORTH;
-    if (map(x, y + 1).type == RABBIT) arr[dirs++] = EAST;
-    if (map(x + 1, y).type == RABBIT) arr[dirs++] = SOUTH;
-    if (map(x, y - 1).type == RABBIT) arr[dirs++] = WEST;
+    if (map(x - 1, y).type == Target) arr[dirs++] = NORTH;
+    if (map(x, y + 1).type == Target) arr[dirs++] = EAST;
+    if (map(x + 1, y).type == Target) arr[dirs++] = SOUTH;
+    if (map(x, y - 1).type == Target) arr[dirs++] = WEST;
     if (dirs > 0) {
         int rnd = selectDirection(x, y, dirs);
         updateCoords(arr[rnd], x, y);
@@ -321,14 +366,6 @@ inline int World::selectDirection(int x, int y, int ndirs) const {
     return (x + y - 2 + current_gen) % (ndirs);
 }
 
-inline bool World::resolveConflictRabbit(const Entity& a, const Entity b) const {
-    return b.type == EMPTY || a.age > b.age;
-}
-
-inline bool World::resolveConflictFox(const Entity& a, const Entity b) const {
-    return b.type == RABBIT || b.type == EMPTY || a.age > b.age || (a.age == b.age && a.hunger < b.hunger);
-}
-
 int World::countEntities() const {
     int k = 0;
     for (int i = 1; i != height; ++i) {
@@ -340,6 +377,13 @@ int World::countEntities() const {
     return k;
 }
 
+/**
+ * Number of entities of type t in rows [r0, r1) and columns [c0, c1)
+ */
+inline int64_t World::countRegion(Entity_t t, int r0, int c0, int r1, int c1) {
+    return density.count(t, r0, c0, r1, c1);
+}
+
 void World::print() const {
     for (int i = 0; i < width + 1; ++i) std::cout << "-";
     std::cout << '\n';
@@ -362,4 +406,6 @@ void World::printText() const {
                           << j - 1 << '\n';
         }
     }
-}
\ No newline at end of file
+}
+
+} // namespace eco
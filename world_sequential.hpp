@@ -7,63 +7,87 @@
 #include <string>
 #include <vector>
 
+#include "arena.hpp"
+#include "cycle.hpp"
 #include "debug.hpp"
+#include "density.hpp"
 #include "entity.hpp"
 #include "matrix.hpp"
+#include "snapshot.hpp"
+#include "species.hpp"
+
+namespace eco {
 
 enum Direction { NORTH, EAST, SOUTH, WEST, INPLACE };
 
 constexpr uint8_t DIRECTIONS_N = 4;
 
 struct World {
-    int GEN_PROC_RABBITS;  // Number of generations until a rabbit can procrate
-    int GEN_PROC_FOXES;    // As above but for foxes
-    int GEN_FOOD_FOXES;    // How many generations a fox can go without food
-    int N_GEN;             // How many generations the world will last
+    SpeciesTable species;  // Breeding and starvation ages, by Entity_t
 
     int current_gen;
     int entity_count;
     int height;
     int width;
 
+    Arena arena;
+
     Matrix<Entity> map;
     Matrix<Entity> nextMap;
 
+    uint64_t hash;  // Zobrist hash of nextMap while detecting, equal to map's between phases
+    CycleDetector cycles;
+
+    int64_t population[ENTITY_TYPES_N];  // Interior cells holding each type
+    DensityIndex density;
+
+    SnapshotWriter* snapshots;  // Receives a frame every snapshot_every generations, if set
+    int snapshot_every;
+    int snapshot_start;         // Generation of the first frame, which the others count from
+
     World() = delete;
-    World(int gen_proc_rabbits, int gen_proc_foxes, int gen_food_foxes,
-          int n_gen, int w, int h, int count)
-        : GEN_PROC_RABBITS(gen_proc_rabbits),
-          GEN_PROC_FOXES(gen_proc_foxes),
-          GEN_FOOD_FOXES(gen_food_foxes),
-          N_GEN(n_gen),
+    World(const SpeciesTable& params, int w, int h, int count)
+        : species(params),
           current_gen(0),
           entity_count(count),
           height(h + 1),
           width(w + 1),
-          map(Matrix<Entity>(h + 2, w + 2)),
-          nextMap(Matrix<Entity>(h + 2, w + 2)) {}
+          arena(arenaBytes(h + 2, w + 2)),
+          map(h + 2, w + 2, arena),
+          nextMap(h + 2, w + 2, arena),
+          hash(0),
+          cycles(h + 2, w + 2, arena),
+          population{static_cast<int64_t>(h) * w},
+          density(h, w, arena),
+          snapshots(nullptr),
+          snapshot_every(0),
+          snapshot_start(0) {}
+
+    static size_t arenaBytes(int h, int w) {
+        return 2 * Matrix<Entity>::bytes(h, w) + CycleDetector::bytes(h, w) +
+               DensityIndex::bytes(h - 2, w - 2);
+    }
 
     void init();
+    void run(int);
     void update();
-    inline void updateRabbits();
-    inline void updateFoxes();
-    void updateRabbit(Entity, int, int);
-    void updateFox(Entity, int, int);
+    template <bool TrackHash> inline void step();
+    template <class S, bool TrackHash> inline void updateSpecies();
+    template <class S, bool TrackHash> inline void updateAnimal(Entity, int, int);
+    template <bool TrackHash> inline void put(int, int, const Entity&);
 
     inline int selectDirection(int, int, int) const;
     inline void updateCoords(Direction, int&, int&) const;
-    inline bool getRabbitMove(int&, int&) const;
-    inline bool getFoxMove(int&, int&) const;
-
-    inline bool resolveConflictRabbit(const Entity&, const Entity) const;
-    inline bool resolveConflictFox(const Entity&, const Entity) const;
+    template <Entity_t Target> inline bool getMove(int&, int&) const;
 
     inline void add(const std::string, const int, const int);
+    inline void add(const Entity_t, const int, const int);
 
     inline bool canMove(const Entity&, const Entity&) const;
     inline bool hasStarved(const Entity&) const;
 
     int countEntities() const;
+    inline int64_t countRegion(Entity_t, int, int, int, int);
 
     void print() const;
     void printText() const;
@@ -74,128 +98,142 @@ void World::init() {
     for (int i = 0; i != height + 1; ++i) {
         map(i, 0) = nextMap(i, 0) = ent;
         map(i, width) = nextMap(i, width) = ent;
-        map(0, i) = nextMap(0, i) = ent;
-        map(height, i) = nextMap(height, i) = ent;
+    }
+    for (int j = 0; j != width + 1; ++j) {
+        map(0, j) = nextMap(0, j) = ent;
+        map(height, j) = nextMap(height, j) = ent;
     }
 }
 
+/**
+ * Advances the world n generations, fast-forwarding once the state repeats or
+ * freezes. Fast-forwarding is off while snapshots are being taken, since it
+ * would skip their generations
+ */
+void World::run(int n) {
+    const int target = current_gen + n;
+    bool detect = snapshots == nullptr;
+
+    if (detect) {
+        hash = hashGrid(map);
+        cycles.reset(map, hash, current_gen);
+    }
 
+    while (current_gen < target) {
+        // The hash is only kept up to date while it can be used
+        if (detect) {
+            step<true>();
+            fastForward(*this, target, detect);
+        } else {
+            step<false>();
+        }
+        if (snapshots != nullptr && (current_gen - snapshot_start) % snapshot_every == 0)
+            snapshots->capture(map, current_gen);
+    }
+}
+
+/**
+ * One generation without cycle detection
+ */
 void World::update() {
-    updateRabbits();
-    map = nextMap;
-    updateFoxes();
-    map = nextMap;
-    current_gen++;
+    step<false>();
 }
 
-void World::updateRabbits() {
-    for (int i = 1; i < height; ++i)
-        for (int j = 1; j < width; ++j)
-            if (map(i, j).type == RABBIT)
-                updateRabbit(map(i, j), i, j);
+template <bool TrackHash>
+inline void World::step() {
+    Ecosystem::forEach([this](auto species) {
+        updateSpecies<typename decltype(species)::type, TrackHash>();
+        map = nextMap;
+    });
+    current_gen++;
 }
 
-void World::updateFoxes() {
+template <class S, bool TrackHash>
+void World::updateSpecies() {
     for (int i = 1; i < height; ++i)
         for (int j = 1; j < width; ++j)
-            if (map(i, j).type == FOX)
-                updateFox(map(i, j), i, j);
+            if (map(i, j).type == S::type)
+                updateAnimal<S, TrackHash>(map(i, j), i, j);
 }
 
-void World::updateRabbit(Entity ent, int x, int y) {
-    dbg::LOGLN("\nRabbit (%d,%d)", x, y);
+/**
+ * Hunters go for an adjacent prey first; failing that, or for everything
+ * else, an adjacent empty cell. Starvation is only checked when nothing was
+ * eaten
+ */
+template <class S, bool TrackHash>
+void World::updateAnimal(Entity ent, int x, int y) {
+    dbg::LOGLN("\n%s (%d,%d)", ENTITY_NAME[S::type].c_str(), x, y);
     int oldX = x, oldY = y;
 
     ++ent.age;
     dbg::LOGLN("Age: %d", ent.age);
 
-    if (getRabbitMove(x, y) == false) {
-        dbg::LOGLN("Staying still");
-        nextMap(oldX, oldY) = ent;
-        return;
-    }
-
-    dbg::LOGLN("Moving to (%d,%d)", x, y);
-
-    if (resolveConflictRabbit(ent, nextMap(x, y)) == false) {
-        dbg::LOGLN("Died attacking");
-    }
-
-    if (ent.age > GEN_PROC_RABBITS) {
-        ent.age = 0;
-        nextMap(oldX, oldY) = {RABBIT};
-    } else {
-        nextMap(oldX, oldY) = {EMPTY};
-    }
-
-    if (resolveConflictRabbit(ent, nextMap(x, y))) 
-        nextMap(x, y) = ent;
-}
-
-void World::updateFox(Entity ent, int x, int y) {
-    dbg::LOGLN("\nFox (%d,%d)", x, y);
-    int oldX = x, oldY = y;
-
-    ++ent.age;
-    dbg::LOGLN("Age: %d", ent.age);
-    dbg::LOGLN("Hunger: %d", ent.hunger + 1);
-
-    if (getFoxMove(x, y) == true) {
-        dbg::LOGLN("Ate rabbit");
+    if (hunts<S>() && getMove<S::prey>(x, y)) {
+        dbg::LOGLN("Ate");
         ent.hunger = 0;
     } else {
-        ++ent.hunger;
-        if (ent.hunger >= GEN_FOOD_FOXES) {
+        if (S::starves && ++ent.hunger >= S::genFood(*this)) {
             dbg::LOGLN("Starved");
-            nextMap(oldX, oldY) = {EMPTY};
+            put<TrackHash>(oldX, oldY, {EMPTY});
             return;
         }
-        if (getRabbitMove(x, y) == false) {
+        if (getMove<EMPTY>(x, y) == false) {
             dbg::LOGLN("Staying still");
-            nextMap(oldX, oldY) = ent;
+            put<TrackHash>(oldX, oldY, ent);
             return;
         }
     }
 
     dbg::LOGLN("Moving to (%d,%d)", x, y);
 
-    if (ent.age > GEN_PROC_FOXES) {
+    if (ent.age > S::genProc(*this)) {
         ent.age = 0;
-        nextMap(oldX, oldY) = {FOX};
+        put<TrackHash>(oldX, oldY, {S::type});
     } else {
-        nextMap(oldX, oldY) = {EMPTY};
+        put<TrackHash>(oldX, oldY, {EMPTY});
     }
 
-    if (resolveConflictFox(ent, nextMap(x, y)))
-        nextMap(x, y) = ent;
+    if (winsCell<S>(ent, nextMap(x, y)))
+        put<TrackHash>(x, y, ent);
+}
+
+template <bool TrackHash>
+inline void World::put(int x, int y, const Entity& e) {
+    const size_t index = static_cast<size_t>(x) * nextMap.width + y;
+    const Entity_t old = nextMap.arr[index].type;
+    if (TrackHash)
+        hash ^= cellKey(index, nextMap.arr[index]) ^ cellKey(index, e);
+    if (old != e.type) {
+        --population[old];
+        ++population[e.type];
+        density.change(x, y, old, e.type);
+    }
+    nextMap.arr[index] = e;
 }
 
 inline void World::add(const std::string e, const int x, const int y) {
-    map(x + 1, y + 1) = nextMap(x + 1, y + 1) = makeEntity(e);
+    add(makeEntity(e).type, x, y);
 }
 
-inline bool World::getRabbitMove(int& x, int& y) const {
-    Direction arr[4];
-    int dirs = 0;
-    if (map(x - 1, y).type == EMPTY) arr[dirs++] = NORTH;
-    if (map(x, y + 1).type == EMPTY) arr[dirs++] = EAST;
-    if (map(x + 1, y).type == EMPTY) arr[dirs++] = SOUTH;
-    if (map(x, y - 1).type == EMPTY) arr[dirs++] = WEST;
-    if (dirs > 0) {
-        int rnd = selectDirection(x, y, dirs);
-        updateCoords(arr[rnd], x, y);
-        return true;
-    }
-    return false;
+inline void World::add(const Entity_t t, const int x, const int y) {
+    --population[map(x + 1, y + 1).type];
+    ++population[t];
+    density.change(x + 1, y + 1, map(x + 1, y + 1).type, t);
+    map(x + 1, y + 1) = nextMap(x + 1, y + 1) = makeEntity(t);
 }
 
-inline bool World::getFoxMove(int& x, int& y) const {
+/**
+ * Moves (x, y) onto a neighbouring cell holding Target, if there is one
+ */
+template <Entity_t Target>
+inline bool World::getMove(int& x, int& y) const {
     Direction arr[4];
     int dirs = 0;
-    if (map(x - 1, y).type == RABBIT) arr[dirs++] = NORTH;
-    if (map(x, y + 1).type == RABBIT) arr[dirs++] = EAST;
-    if (map(x + 1, y).type == RABBIT) arr[dirs++] = SOUTH;
-    if (map(x, y - 1).type == RABBIT) arr[dirs++] = WEST;
+    if (map(x - 1, y).type == Target) arr[dirs++] = NORTH;
+    if (map(x, y + 1).type == Target) arr[dirs++] = EAST;
+    if (map(x + 1, y).type == Target) arr[dirs++] = SOUTH;
+    if (map(x, y - 1).type == Target) arr[dirs++] = WEST;
     if (dirs > 0) {
         int rnd = selectDirection(x, y, dirs);
         updateCoords(arr[rnd], x, y);
@@ -218,14 +256,6 @@ inline int World::selectDirection(int x, int y, int ndirs) const {
     return (x + y - 2 + current_gen) % (ndirs);
 }
 
-inline bool World::resolveConflictRabbit(const Entity& a, const Entity b) const {
-    return b.type == EMPTY || a.age > b.age;
-}
-
-inline bool World::resolveConflictFox(const Entity& a, const Entity b) const {
-    return b.type == RABBIT || b.type == EMPTY || a.age > b.age || (a.age == b.age && a.hunger < b.hunger);
-}
-
 int World::countEntities() const {
     int k = 0;
     for (int i = 1; i != height; ++i) {
@@ -237,6 +267,13 @@ int World::countEntities() const {
     return k;
 }
 
+/**
+ * Number of entities of type t in rows [r0, r1) and columns [c0, c1)
+ */
+inline int64_t World::countRegion(Entity_t t, int r0, int c0, int r1, int c1) {
+    return density.count(t, r0, c0, r1, c1);
+}
+
 void World::print() const {
     for (int i = 0; i < width + 1; ++i) std::cout << "-";
     std::cout << '\n';
@@ -259,4 +296,6 @@ void World::printText() const {
                           << j - 1 << '\n';
         }
     }
-}
\ No newline at end of file
+}
+
+} // namespace eco